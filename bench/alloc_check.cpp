@@ -0,0 +1,545 @@
+#include "device_registry.h"
+#include "event_loop.h"
+#include "gamepad.h"
+#include "inhibit_backend.h"
+#include "inhibitor.h"
+#include "metrics.h"
+#include "recording.h"
+#include "remapper.h"
+#include "state_snapshot.h"
+#include "status_log.h"
+#include "virtual_gamepad.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef WAYPAD_HAVE_DBUS
+#include "fake_screensaver.h"
+#endif
+
+using namespace std;
+
+// Replays a long input trace through everything the daemon runs per event
+// once it is up, and fails if a single allocation happens after the
+// warm-up pass. malloc and friends are interposed for the whole process,
+// which also catches operator new and anything the C libraries allocate;
+// only the replaying thread is counted.
+//
+// The in-memory phase feeds events straight into decoding and
+// classification, remapping, per-device metrics, the state snapshot, the
+// inhibitor state machine and the status log, and every few hundred
+// reports exports the metrics the way --metrics-file and --metrics-socket
+// do, with a client reading the socket. The registry phase, which
+// needs a writable /dev/uinput and is skipped otherwise, injects the same
+// reports through one uinput pad per recorded device and reads them back
+// through DeviceRegistry with the chosen --backend, so the epoll dispatch
+// and the read path are covered too.
+//
+// With --dbus the inhibitor drives DBusInhibitBackend against a
+// FakeScreenSaver on the session bus, so run it under dbus-run-session.
+// libdbus allocates for every message it builds or parses, which is
+// outside waypad's control: allocations made inside backend calls are
+// reported per transition and do not fail the check, while everything
+// waypad does around them still has to allocate nothing. Wayland requests
+// are left out for the same reason, and because they need a compositor.
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+static atomic<bool> counting{false};
+static atomic<uint64_t> allocations{0};
+static atomic<uint64_t> allocatedBytes{0};
+static atomic<uint64_t> libraryAllocations{0};
+static thread_local bool replayThread = false;
+static thread_local int libraryDepth = 0;
+
+static void noteAllocation(size_t size) {
+  if (!replayThread || !counting.load(memory_order_relaxed)) {
+    return;
+  }
+  if (libraryDepth > 0) {
+    libraryAllocations.fetch_add(1, memory_order_relaxed);
+    return;
+  }
+  allocations.fetch_add(1, memory_order_relaxed);
+  allocatedBytes.fetch_add(size, memory_order_relaxed);
+}
+
+extern "C" void *malloc(size_t size) {
+  noteAllocation(size);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) {
+  noteAllocation(count * size);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size) {
+  noteAllocation(size);
+  return __libc_realloc(pointer, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) {
+  noteAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) {
+  noteAllocation(size);
+  return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **out, size_t alignment, size_t size) {
+  noteAllocation(size);
+  void *pointer = __libc_memalign(alignment, size);
+  if (!pointer) {
+    return ENOMEM;
+  }
+  *out = pointer;
+  return 0;
+}
+
+// Allocations made while one is alive are the library's, not waypad's.
+struct LibraryScope {
+  LibraryScope() { libraryDepth++; }
+  ~LibraryScope() { libraryDepth--; }
+};
+
+// Forwards to a real backend with its calls inside a LibraryScope, and
+// counts the transitions they cost.
+class AccountedBackend : public InhibitBackend {
+public:
+  explicit AccountedBackend(unique_ptr<InhibitBackend> backend)
+      : backend(move(backend)) {}
+  const char *name() const override { return backend->name(); }
+  int fd() const override { return backend->fd(); }
+  bool prepare() override {
+    LibraryScope scope;
+    return backend->prepare();
+  }
+  bool dispatch(bool readable) override {
+    LibraryScope scope;
+    return backend->dispatch(readable);
+  }
+  void inhibit() override {
+    LibraryScope scope;
+    countTransition();
+    backend->inhibit();
+  }
+  void uninhibit() override {
+    LibraryScope scope;
+    countTransition();
+    backend->uninhibit();
+  }
+  unsigned int messagesPerTransition() const override {
+    return backend->messagesPerTransition();
+  }
+
+  // Only those made while allocations are counted.
+  uint64_t transitions = 0;
+
+private:
+  void countTransition() {
+    if (counting.load(memory_order_relaxed)) {
+      transitions++;
+    }
+  }
+
+  unique_ptr<InhibitBackend> backend;
+};
+
+// Reports between two metrics exports.
+#define SCRAPE_INTERVAL 256
+
+// Writes the metrics file and serves one socket client every
+// SCRAPE_INTERVAL reports, as the metrics timer and socket do.
+struct MetricsScraper {
+  Metrics &metrics;
+  MetricsSocket socket;
+  string file;
+  struct sockaddr_un address = {};
+  uint64_t reports = 0;
+  uint64_t scrapes = 0;
+  bool failed = false;
+
+  MetricsScraper(Metrics &metrics, const string &base)
+      : metrics(metrics), file(base + ".prom") {
+    string path = base + ".sock";
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    failed = !socket.open(path);
+  }
+  ~MetricsScraper() { unlink(file.c_str()); }
+
+  void tick() {
+    if (failed || ++reports % SCRAPE_INTERVAL != 0) {
+      return;
+    }
+    int client = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    failed = client == -1 ||
+             connect(client, reinterpret_cast<struct sockaddr *>(&address),
+                     sizeof(address)) == -1 ||
+             !metrics.writeFile(file);
+    if (!failed) {
+      socket.serve(metrics);
+      char buffer[4096];
+      while (read(client, buffer, sizeof(buffer)) > 0) {
+      }
+      scrapes++;
+    }
+    if (client != -1) {
+      close(client);
+    }
+  }
+};
+
+// What the main loop does with the inhibitor after handling input: flush
+// the desired state, send it, pick up any replies, and publish the result.
+// Metrics are exported from the same loop.
+struct InhibitDriver {
+  Inhibitor &inhibitor;
+  AccountedBackend *backend;
+  StateSnapshot *snapshot;
+  MetricsScraper &scraper;
+  bool published = false;
+  bool failed = false;
+
+  void run(chrono::steady_clock::time_point now) {
+    scraper.tick();
+    inhibitor.flush();
+    if (backend && !failed) {
+      struct pollfd bus = {backend->fd(), POLLIN, 0};
+      bool readable = poll(&bus, 1, 0) > 0;
+      failed = !backend->dispatch(readable) || !backend->prepare();
+    }
+    if (snapshot && inhibitor.isInhibiting() != published) {
+      published = inhibitor.isInhibiting();
+      snapshot->publishInhibitor(published, now);
+    }
+  }
+};
+
+struct ReplayDevice {
+  GamepadModel model;
+  DeviceMetrics *metrics = nullptr;
+  unique_ptr<Remapper> remapper;
+  int snapshotSlot = -1;
+};
+
+// Each pass is shifted past the previous one so time never runs backwards.
+static chrono::steady_clock::duration passLength(const Recording &recording) {
+  return eventTime(toInputEvent(recording.events.back())) -
+         chrono::steady_clock::time_point() + chrono::seconds(10);
+}
+
+// Event timestamps drive the inhibitor, so idle periods in the trace turn
+// into real state transitions and status lines.
+static void replay(const Recording &recording, vector<ReplayDevice> &devices,
+                   InhibitDriver &driver, StateSnapshot *snapshot, int sink,
+                   size_t pass) {
+  auto length = passLength(recording);
+  for (const RecordedEvent &recorded : recording.events) {
+    if (recorded.device >= devices.size() ||
+        !devices[recorded.device].remapper) {
+      continue;
+    }
+    ReplayDevice &device = devices[recorded.device];
+    input_event ev = toInputEvent(recorded);
+    device.model.applyEvent(ev);
+    device.remapper->translate(ev, *device.model.profile);
+    device.metrics->events.add();
+    if (ev.type != EV_SYN || ev.code != SYN_REPORT) {
+      continue;
+    }
+    chrono::steady_clock::time_point now = eventTime(ev) + length * pass;
+    device.remapper->flush(device.model, now);
+    bool active = device.model.classify();
+    if (snapshot && device.snapshotSlot >= 0) {
+      snapshot->publish(device.snapshotSlot, device.model, active,
+                        active ? now : chrono::steady_clock::time_point());
+    }
+    if (active) {
+      device.metrics->activeBatches.add();
+      device.metrics->detectionLatency.observe(chrono::microseconds(20));
+      driver.inhibitor.onActivity(now, now);
+    } else {
+      driver.inhibitor.update(now);
+    }
+    driver.run(now);
+    flushStatusLog(sink);
+  }
+}
+
+struct RegistryDevice {
+  unique_ptr<VirtualGamepad> pad;
+  vector<input_event> pending;
+};
+
+// Emits each report through its uinput pad and drains the registry the
+// way the input loop does, with trace time standing in for the clock.
+static void replayRegistry(const Recording &recording,
+                           vector<RegistryDevice> &pads,
+                           DeviceRegistry &registry, int epollFd,
+                           InhibitDriver &driver, int sink, size_t pass) {
+  auto length = passLength(recording);
+  epoll_event ready[16];
+  for (const RecordedEvent &recorded : recording.events) {
+    if (recorded.device >= pads.size() || !pads[recorded.device].pad) {
+      continue;
+    }
+    RegistryDevice &device = pads[recorded.device];
+    input_event ev = toInputEvent(recorded);
+    device.pending.push_back(ev);
+    if (ev.type != EV_SYN || ev.code != SYN_REPORT) {
+      continue;
+    }
+    device.pad->emit(device.pending.data(), device.pending.size());
+    device.pending.clear();
+    int count;
+    while ((count = epoll_wait(epollFd, ready, 16, 0)) > 0) {
+      for (int i = 0; i < count; i++) {
+        registry.handleEpollEvent(ready[i].data.u64);
+      }
+    }
+    registry.reap();
+    chrono::steady_clock::time_point now = eventTime(ev) + length * pass;
+    if (registry.takeActivityTime() != chrono::steady_clock::time_point::max()) {
+      driver.inhibitor.onActivity(now, now);
+    } else {
+      driver.inhibitor.update(now);
+    }
+    driver.run(now);
+    flushStatusLog(sink);
+  }
+}
+
+static bool parseBackend(const char *name, InputBackend &backend) {
+  if (strcmp(name, "libevdev") == 0) {
+    backend = InputBackend::Libevdev;
+  } else if (strcmp(name, "raw") == 0) {
+    backend = InputBackend::Raw;
+  } else if (strcmp(name, "io_uring") == 0) {
+    backend = InputBackend::IoUring;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0
+       << " [--synthetic EVENTS] [--devices N] [--passes N]"
+          " [--backend libevdev|raw|io_uring] [--dbus] [FILE]"
+       << endl;
+}
+
+int main(int argc, char **argv) {
+  string path;
+  size_t syntheticEvents = 2000000;
+  size_t deviceCount = 4;
+  size_t passes = 5;
+  InputBackend inputBackend = InputBackend::Libevdev;
+  bool dbus = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+      syntheticEvents = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) {
+      deviceCount = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--passes") == 0 && i + 1 < argc) {
+      passes = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc &&
+               parseBackend(argv[i + 1], inputBackend)) {
+      i++;
+    } else if (strcmp(argv[i], "--dbus") == 0) {
+      dbus = true;
+    } else if (argv[i][0] != '-' && path.empty()) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  replayThread = true;
+
+  int sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (sink == -1) {
+    cerr << "Failed to open /dev/null: " << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+
+#ifdef WAYPAD_HAVE_DBUS
+  FakeScreenSaver service;
+#endif
+  unique_ptr<AccountedBackend> backend;
+  if (dbus) {
+#ifdef WAYPAD_HAVE_DBUS
+    unique_ptr<DBusInhibitBackend> bus;
+    if (!service.start() || !(bus = DBusInhibitBackend::create()) ||
+        !bus->waitForService()) {
+      cerr << "Failed to reach the fake screensaver; run under "
+              "dbus-run-session"
+           << endl;
+      return EXIT_FAILURE;
+    }
+    backend = make_unique<AccountedBackend>(move(bus));
+#else
+    cerr << "Built without libdbus" << endl;
+    return EXIT_FAILURE;
+#endif
+  }
+
+  StateSnapshot snapshot;
+  string snapshotName = "/waypad-alloc-check-" + to_string(getpid());
+  bool haveSnapshot = snapshot.open(snapshotName);
+  if (!haveSnapshot) {
+    cout << "state snapshot:  skipped, " << strerror(errno) << endl;
+  }
+
+  uint64_t transitions = 0;
+  uint64_t libraryTotal = 0;
+  try {
+    Recording recording = path.empty()
+                              ? synthesizeRecording(syntheticEvents, deviceCount)
+                              : loadRecording(path);
+    if (recording.events.empty()) {
+      cerr << "Nothing to replay" << endl;
+      return EXIT_FAILURE;
+    }
+    Metrics metrics;
+    RemapTable table(*findRemapProfile("desktop"));
+    vector<ReplayDevice> devices;
+    for (const RecordedDevice &recorded : recording.devices) {
+      if (devices.size() <= recorded.device) {
+        devices.resize(recorded.device + 1);
+      }
+      ReplayDevice &device = devices[recorded.device];
+      device.model = GamepadModel(
+          recorded.absinfo,
+          findControllerProfile(recorded.vendor, recorded.product));
+      device.metrics =
+          metrics.addDevice("replay" + to_string(recorded.device));
+      device.remapper = make_unique<Remapper>(table, sink);
+      if (haveSnapshot) {
+        device.snapshotSlot =
+            snapshot.acquire("replay" + to_string(recorded.device),
+                             recorded.vendor, recorded.product,
+                             NodeRole::Buttons);
+      }
+    }
+
+    InhibitConfig config;
+    config.idleTimeout = chrono::seconds(1);
+    config.releaseGrace = chrono::milliseconds(500);
+    Inhibitor inhibitor(backend.get(), config,
+                        chrono::steady_clock::time_point());
+    inhibitor.setMetrics(&metrics.inhibitor);
+    MetricsScraper scraper(metrics,
+                           "/tmp/waypad-alloc-check-" + to_string(getpid()));
+    if (scraper.failed) {
+      cerr << "Failed to open the metrics socket: " << strerror(errno)
+           << endl;
+      return EXIT_FAILURE;
+    }
+    InhibitDriver driver{inhibitor, backend.get(),
+                         haveSnapshot ? &snapshot : nullptr, scraper};
+
+    replay(recording, devices, driver, driver.snapshot, sink, 0);
+    counting.store(true);
+    for (size_t i = 1; i <= passes; i++) {
+      replay(recording, devices, driver, driver.snapshot, sink, i);
+    }
+    counting.store(false);
+    cout << "in memory:       " << recording.events.size() << " events x "
+         << passes << ", " << allocations.load() << " allocations ("
+         << allocatedBytes.load() << " bytes)" << endl;
+
+    if (access("/dev/uinput", W_OK) != 0) {
+      cout << "registry:        skipped, /dev/uinput is not writable" << endl;
+    } else {
+      // The registry keeps its own remapper and metrics for the pads it
+      // opens, and time moves on from where the in-memory phase stopped.
+      int epollFd = epoll_create1(EPOLL_CLOEXEC);
+      vector<RegistryDevice> pads;
+      for (const RecordedDevice &recorded : recording.devices) {
+        if (pads.size() <= recorded.device) {
+          pads.resize(recorded.device + 1);
+        }
+        RegistryDevice &pad = pads[recorded.device];
+        pad.pad = make_unique<VirtualGamepad>(
+            "waypad alloc-check " + to_string(recorded.device),
+            recorded.vendor, recorded.product, recorded.absinfo);
+        pad.pending.reserve(64);
+        waitForNode(pad.pad->devicePath());
+      }
+      DeviceRegistry registry(epollFd);
+      registry.setBackend(inputBackend);
+      registry.setMetrics(&metrics);
+      registry.setSnapshot(haveSnapshot ? &snapshot : nullptr);
+      registry.setRemap(&table);
+      for (const RegistryDevice &pad : pads) {
+        if (pad.pad) {
+          registry.add(pad.pad->devicePath());
+        }
+      }
+
+      uint64_t before = allocations.load();
+      uint64_t beforeBytes = allocatedBytes.load();
+      replayRegistry(recording, pads, registry, epollFd, driver, sink,
+                     passes + 1);
+      counting.store(true);
+      for (size_t i = 1; i <= passes; i++) {
+        replayRegistry(recording, pads, registry, epollFd, driver, sink,
+                       passes + 1 + i);
+      }
+      counting.store(false);
+      cout << "registry:        " << recording.events.size() << " events x "
+           << passes << ", " << allocations.load() - before
+           << " allocations (" << allocatedBytes.load() - beforeBytes
+           << " bytes)" << endl;
+      close(epollFd);
+    }
+
+    cout << "metrics exports: " << scraper.scrapes << endl;
+    if (scraper.failed) {
+      cerr << "Failed to export metrics" << endl;
+      return EXIT_FAILURE;
+    }
+    if (backend) {
+      transitions = backend->transitions;
+      libraryTotal = libraryAllocations.load();
+    }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  if (backend) {
+    cout << "inhibit backend: " << backend->name() << ", " << transitions
+         << " transitions, " << libraryTotal << " library allocations";
+    if (transitions > 0) {
+      cout << " (" << static_cast<double>(libraryTotal) / transitions
+           << " per transition)";
+    }
+    cout << endl;
+  }
+  cout << "allocations:     " << allocations.load() << endl;
+  cout << "allocated bytes: " << allocatedBytes.load() << endl;
+  close(sink);
+  return allocations.load() == 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,97 @@
+#include "fake_screensaver.h"
+#include <dbus/dbus.h>
+#include <iostream>
+
+using namespace std;
+
+bool FakeScreenSaver::start() {
+  DBusError error;
+  dbus_error_init(&error);
+  connection = dbus_bus_get_private(DBUS_BUS_SESSION, &error);
+  if (!connection) {
+    cerr << "Failed to connect to the session bus: " << error.message << endl;
+    dbus_error_free(&error);
+    return false;
+  }
+  dbus_connection_set_exit_on_disconnect(connection, FALSE);
+  if (dbus_bus_request_name(connection, "org.freedesktop.ScreenSaver",
+                            DBUS_NAME_FLAG_DO_NOT_QUEUE, &error) !=
+      DBUS_REQUEST_NAME_REPLY_PRIMARY_OWNER) {
+    cerr << "Failed to own org.freedesktop.ScreenSaver" << endl;
+    dbus_error_free(&error);
+    return false;
+  }
+  worker = thread(&FakeScreenSaver::run, this);
+  return true;
+}
+
+void FakeScreenSaver::stop() {
+  if (worker.joinable()) {
+    stopping.store(true);
+    worker.join();
+  }
+  if (connection) {
+    dbus_connection_close(connection);
+    dbus_connection_unref(connection);
+    connection = nullptr;
+  }
+}
+
+void FakeScreenSaver::setReplyDelay(Clock::duration delay) {
+  lock_guard<mutex> lock(guard);
+  replyDelay = delay;
+}
+
+vector<string> FakeScreenSaver::takeCalls() {
+  lock_guard<mutex> lock(guard);
+  return move(calls);
+}
+
+size_t FakeScreenSaver::activeInhibitions() {
+  lock_guard<mutex> lock(guard);
+  return active.size();
+}
+
+void FakeScreenSaver::run() {
+  while (!stopping.load()) {
+    dbus_connection_read_write(connection, 1);
+    while (DBusMessage *message = dbus_connection_pop_message(connection)) {
+      handle(message);
+      dbus_message_unref(message);
+    }
+    auto now = Clock::now();
+    for (auto it = pending.begin(); it != pending.end();) {
+      if (it->due <= now) {
+        dbus_connection_send(connection, it->reply, nullptr);
+        dbus_message_unref(it->reply);
+        it = pending.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    dbus_connection_flush(connection);
+  }
+  for (PendingReply &reply : pending) {
+    dbus_message_unref(reply.reply);
+  }
+}
+
+void FakeScreenSaver::handle(DBusMessage *message) {
+  const char *interface = "org.freedesktop.ScreenSaver";
+  lock_guard<mutex> lock(guard);
+  if (dbus_message_is_method_call(message, interface, "Inhibit")) {
+    uint32_t cookie = nextCookie++;
+    active.insert(cookie);
+    calls.push_back("Inhibit " + to_string(cookie));
+    DBusMessage *reply = dbus_message_new_method_return(message);
+    dbus_message_append_args(reply, DBUS_TYPE_UINT32, &cookie,
+                             DBUS_TYPE_INVALID);
+    pending.push_back({reply, Clock::now() + replyDelay});
+  } else if (dbus_message_is_method_call(message, interface, "UnInhibit")) {
+    uint32_t cookie = 0;
+    dbus_message_get_args(message, nullptr, DBUS_TYPE_UINT32, &cookie,
+                          DBUS_TYPE_INVALID);
+    active.erase(cookie);
+    calls.push_back("UnInhibit " + to_string(cookie));
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct DBusConnection;
+struct DBusMessage;
+
+// A stand-in org.freedesktop.ScreenSaver on the session bus, served from
+// its own thread over a connection of its own, that answers Inhibit after
+// a configurable delay the way a busy desktop might. Run whatever uses it
+// under dbus-run-session so it gets a bus of its own.
+class FakeScreenSaver {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  FakeScreenSaver() = default;
+  FakeScreenSaver(const FakeScreenSaver &) = delete;
+  FakeScreenSaver &operator=(const FakeScreenSaver &) = delete;
+  ~FakeScreenSaver() { stop(); }
+  bool start();
+  void stop();
+  void setReplyDelay(Clock::duration delay);
+  // Calls received since the last take, e.g. "Inhibit 1" for an Inhibit
+  // that was answered with cookie 1.
+  std::vector<std::string> takeCalls();
+  size_t activeInhibitions();
+
+private:
+  struct PendingReply {
+    DBusMessage *reply;
+    Clock::time_point due;
+  };
+
+  void run();
+  void handle(DBusMessage *message);
+
+  DBusConnection *connection = nullptr;
+  std::thread worker;
+  std::atomic<bool> stopping{false};
+  std::mutex guard;
+  Clock::duration replyDelay{};
+  uint32_t nextCookie = 1;
+  std::set<uint32_t> active;
+  std::vector<std::string> calls;
+  std::vector<PendingReply> pending;
+};
@@ -0,0 +1,324 @@
+#include "headless_compositor.h"
+#include "ext-idle-notify-v1-server-protocol.h"
+#include "idle-inhibit-unstable-v1-server-protocol.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-server.h>
+
+using namespace std;
+
+#define COMPOSITOR_VERSION 4
+
+static CompositorStats &statsOf(wl_resource *resource) {
+  return *static_cast<CompositorStats *>(wl_resource_get_user_data(resource));
+}
+
+static void destroyResource(wl_client *, wl_resource *resource) {
+  statsOf(resource).requests++;
+  wl_resource_destroy(resource);
+}
+
+static void countRequest(wl_client *, wl_resource *resource) {
+  statsOf(resource).requests++;
+}
+
+static const struct wl_region_interface regionImpl = {
+    .destroy = destroyResource,
+    .add = [](wl_client *client, wl_resource *resource, int32_t, int32_t,
+              int32_t, int32_t) { countRequest(client, resource); },
+    .subtract = [](wl_client *client, wl_resource *resource, int32_t, int32_t,
+                   int32_t, int32_t) { countRequest(client, resource); },
+};
+
+static void surfaceFrame(wl_client *client, wl_resource *resource,
+                         uint32_t id) {
+  statsOf(resource).requests++;
+  wl_resource *callback = wl_resource_create(client, &wl_callback_interface,
+                                             1, id);
+  if (!callback) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_callback_send_done(callback, 0);
+  wl_resource_destroy(callback);
+}
+
+static void surfaceCommit(wl_client *, wl_resource *resource) {
+  CompositorStats &stats = statsOf(resource);
+  stats.requests++;
+  stats.commits++;
+}
+
+// wl_surface.offset only exists from version 5 on.
+static const struct wl_surface_interface surfaceImpl = {
+    .destroy = destroyResource,
+    .attach = [](wl_client *client, wl_resource *resource, wl_resource *,
+                 int32_t, int32_t) { countRequest(client, resource); },
+    .damage = [](wl_client *client, wl_resource *resource, int32_t, int32_t,
+                 int32_t, int32_t) { countRequest(client, resource); },
+    .frame = surfaceFrame,
+    .set_opaque_region = [](wl_client *client, wl_resource *resource,
+                            wl_resource *) { countRequest(client, resource); },
+    .set_input_region = [](wl_client *client, wl_resource *resource,
+                           wl_resource *) { countRequest(client, resource); },
+    .commit = surfaceCommit,
+    .set_buffer_transform = [](wl_client *client, wl_resource *resource,
+                               int32_t) { countRequest(client, resource); },
+    .set_buffer_scale = [](wl_client *client, wl_resource *resource,
+                           int32_t) { countRequest(client, resource); },
+    .damage_buffer = [](wl_client *client, wl_resource *resource, int32_t,
+                        int32_t, int32_t,
+                        int32_t) { countRequest(client, resource); },
+    .offset = [](wl_client *client, wl_resource *resource, int32_t,
+                 int32_t) { countRequest(client, resource); },
+};
+
+static void createChild(wl_client *client, wl_resource *parent, uint32_t id,
+                        const wl_interface *interface,
+                        const void *implementation) {
+  CompositorStats &stats = statsOf(parent);
+  stats.requests++;
+  wl_resource *resource = wl_resource_create(
+      client, interface, wl_resource_get_version(parent), id);
+  if (!resource) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(resource, implementation, &stats, nullptr);
+}
+
+static const struct wl_compositor_interface compositorImpl = {
+    .create_surface =
+        [](wl_client *client, wl_resource *resource, uint32_t id) {
+          createChild(client, resource, id, &wl_surface_interface,
+                      &surfaceImpl);
+        },
+    .create_region =
+        [](wl_client *client, wl_resource *resource, uint32_t id) {
+          createChild(client, resource, id, &wl_region_interface,
+                      &regionImpl);
+        },
+};
+
+static void destroyInhibitor(wl_client *client, wl_resource *resource) {
+  statsOf(resource).inhibitorsDestroyed++;
+  destroyResource(client, resource);
+}
+
+static const struct zwp_idle_inhibitor_v1_interface inhibitorImpl = {
+    .destroy = destroyInhibitor,
+};
+
+static void createInhibitor(wl_client *client, wl_resource *resource,
+                            uint32_t id, wl_resource *) {
+  CompositorStats &stats = statsOf(resource);
+  stats.lastInhibitNs =
+      chrono::duration_cast<chrono::nanoseconds>(
+          chrono::steady_clock::now().time_since_epoch())
+          .count();
+  stats.inhibitorsCreated++;
+  createChild(client, resource, id, &zwp_idle_inhibitor_v1_interface,
+              &inhibitorImpl);
+}
+
+static const struct zwp_idle_inhibit_manager_v1_interface inhibitManagerImpl =
+    {
+        .destroy = destroyResource,
+        .create_inhibitor = createInhibitor,
+};
+
+// The client never asks the seat for input devices.
+static const struct wl_seat_interface seatImpl = {
+    .get_pointer = [](wl_client *client, wl_resource *resource,
+                      uint32_t) { countRequest(client, resource); },
+    .get_keyboard = [](wl_client *client, wl_resource *resource,
+                       uint32_t) { countRequest(client, resource); },
+    .get_touch = [](wl_client *client, wl_resource *resource,
+                    uint32_t) { countRequest(client, resource); },
+    .release = destroyResource,
+};
+
+static HeadlessCompositor &compositorOf(wl_resource *resource) {
+  return *static_cast<HeadlessCompositor *>(
+      wl_resource_get_user_data(resource));
+}
+
+static void bindGlobal(wl_client *client, void *data, uint32_t version,
+                       uint32_t id, const wl_interface *interface,
+                       const void *implementation) {
+  wl_resource *resource = wl_resource_create(client, interface, version, id);
+  if (!resource) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(resource, implementation, data, nullptr);
+}
+
+HeadlessCompositor::HeadlessCompositor() {
+  display = wl_display_create();
+  if (!display) {
+    throw runtime_error("Failed to create Wayland display");
+  }
+  wl_global_create(display, &wl_compositor_interface, COMPOSITOR_VERSION,
+                   &counters,
+                   [](wl_client *client, void *data, uint32_t version,
+                      uint32_t id) {
+                     bindGlobal(client, data, version, id,
+                                &wl_compositor_interface, &compositorImpl);
+                   });
+  wl_global_create(display, &wl_seat_interface, 1, &counters,
+                   [](wl_client *client, void *data, uint32_t version,
+                      uint32_t id) {
+                     bindGlobal(client, data, version, id,
+                                &wl_seat_interface, &seatImpl);
+                   });
+  wl_global_create(display, &ext_idle_notifier_v1_interface, 2, this,
+                   bindIdleNotifier);
+  wl_global_create(display, &zwp_idle_inhibit_manager_v1_interface, 1,
+                   &counters,
+                   [](wl_client *client, void *data, uint32_t version,
+                      uint32_t id) {
+                     bindGlobal(client, data, version, id,
+                                &zwp_idle_inhibit_manager_v1_interface,
+                                &inhibitManagerImpl);
+                   });
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1) {
+    wl_display_destroy(display);
+    throw runtime_error("Failed to create socket pair: " +
+                        string(strerror(errno)));
+  }
+  stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  seatFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  wl_event_loop *loop = wl_display_get_event_loop(display);
+  if (stopFd == -1 || seatFd == -1 || !wl_client_create(display, fds[0]) ||
+      !wl_event_loop_add_fd(loop, stopFd, WL_EVENT_READABLE, handleStop,
+                            display) ||
+      !wl_event_loop_add_fd(loop, seatFd, WL_EVENT_READABLE, handleSeat,
+                            this)) {
+    close(fds[0]);
+    close(fds[1]);
+    if (stopFd != -1) {
+      close(stopFd);
+    }
+    if (seatFd != -1) {
+      close(seatFd);
+    }
+    wl_display_destroy(display);
+    throw runtime_error("Failed to set up headless compositor");
+  }
+  peerFd = fds[1];
+  thread = std::thread(wl_display_run, display);
+}
+
+// The client side of the socket belongs to whoever passed clientFd() to
+// wl_display_connect_to_fd().
+HeadlessCompositor::~HeadlessCompositor() {
+  uint64_t one = 1;
+  while (write(stopFd, &one, sizeof(one)) == -1 && errno == EINTR) {
+  }
+  thread.join();
+  wl_display_destroy_clients(display);
+  wl_display_destroy(display);
+  close(stopFd);
+  close(seatFd);
+}
+
+int HeadlessCompositor::handleStop(int, uint32_t, void *data) {
+  wl_display_terminate(static_cast<wl_display *>(data));
+  return 0;
+}
+
+void HeadlessCompositor::setSeatIdle(bool idle) {
+  wantSeatIdle.store(idle);
+  uint64_t request = ++seatRequests;
+  uint64_t one = 1;
+  while (write(seatFd, &one, sizeof(one)) == -1 && errno == EINTR) {
+  }
+  while (seatUpdates.load() < request) {
+    this_thread::yield();
+  }
+}
+
+int HeadlessCompositor::handleSeat(int fd, uint32_t, void *data) {
+  auto *compositor = static_cast<HeadlessCompositor *>(data);
+  uint64_t count;
+  while (read(fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+  }
+  uint64_t request = compositor->seatRequests.load();
+  bool idle = compositor->wantSeatIdle.load();
+  if (idle != compositor->seatIdle) {
+    compositor->seatIdle = idle;
+    for (wl_resource *notification : compositor->idleNotifications) {
+      if (idle) {
+        ext_idle_notification_v1_send_idled(notification);
+      } else {
+        ext_idle_notification_v1_send_resumed(notification);
+      }
+    }
+  }
+  wl_display_flush_clients(compositor->display);
+  compositor->seatUpdates.store(request);
+  return 0;
+}
+
+void HeadlessCompositor::bindIdleNotifier(wl_client *client, void *data,
+                                          uint32_t version, uint32_t id) {
+  static const struct ext_idle_notifier_v1_interface notifierImpl = {
+      .destroy =
+          [](wl_client *, wl_resource *resource) {
+            compositorOf(resource).counters.requests++;
+            wl_resource_destroy(resource);
+          },
+      .get_idle_notification = createIdleNotification,
+      .get_input_idle_notification = createIdleNotification,
+  };
+  bindGlobal(client, data, version, id, &ext_idle_notifier_v1_interface,
+             &notifierImpl);
+}
+
+// Every notification shares the one seat and ignores its timeout: it is
+// idle exactly when setSeatIdle() last said so.
+void HeadlessCompositor::createIdleNotification(wl_client *client,
+                                                wl_resource *resource,
+                                                uint32_t id, uint32_t,
+                                                wl_resource *) {
+  static const struct ext_idle_notification_v1_interface notificationImpl = {
+      .destroy =
+          [](wl_client *, wl_resource *resource) {
+            compositorOf(resource).counters.requests++;
+            wl_resource_destroy(resource);
+          },
+  };
+  HeadlessCompositor &compositor = compositorOf(resource);
+  compositor.counters.requests++;
+  compositor.counters.idleNotifications++;
+  wl_resource *notification =
+      wl_resource_create(client, &ext_idle_notification_v1_interface,
+                         wl_resource_get_version(resource), id);
+  if (!notification) {
+    wl_client_post_no_memory(client);
+    return;
+  }
+  wl_resource_set_implementation(notification, &notificationImpl,
+                                 &compositor, destroyIdleNotification);
+  compositor.idleNotifications.push_back(notification);
+  if (compositor.seatIdle) {
+    ext_idle_notification_v1_send_idled(notification);
+  }
+}
+
+void HeadlessCompositor::destroyIdleNotification(wl_resource *resource) {
+  vector<wl_resource *> &notifications =
+      compositorOf(resource).idleNotifications;
+  notifications.erase(
+      remove(notifications.begin(), notifications.end(), resource),
+      notifications.end());
+}
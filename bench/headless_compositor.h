@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+struct wl_client;
+struct wl_display;
+struct wl_resource;
+
+// What the compositor saw, readable from any thread. After a
+// wl_display_roundtrip() on the client side every request sent before it
+// is accounted for.
+struct CompositorStats {
+  std::atomic<uint64_t> requests{0};
+  std::atomic<uint64_t> commits{0};
+  std::atomic<uint64_t> inhibitorsCreated{0};
+  std::atomic<uint64_t> inhibitorsDestroyed{0};
+  std::atomic<int64_t> lastInhibitNs{0};
+  std::atomic<uint64_t> idleNotifications{0};
+};
+
+// A stand-in compositor that implements only wl_compositor,
+// zwp_idle_inhibit_manager_v1, an input-less wl_seat and
+// ext_idle_notifier_v1. It serves a single client over a socketpair from
+// its own thread, so the real wlContext code can be pointed at it with
+// connectToWayland(context, clientFd()) without a session or a socket in
+// XDG_RUNTIME_DIR. Inhibitor creation is timestamped on steady_clock. The
+// seat has no input of its own; setSeatIdle() plays the user walking away
+// from or returning to the keyboard.
+class HeadlessCompositor {
+public:
+  HeadlessCompositor();
+  ~HeadlessCompositor();
+  HeadlessCompositor(const HeadlessCompositor &) = delete;
+  HeadlessCompositor &operator=(const HeadlessCompositor &) = delete;
+  int clientFd() const { return peerFd; }
+  const CompositorStats &stats() const { return counters; }
+  bool isInhibited() const {
+    return counters.inhibitorsCreated > counters.inhibitorsDestroyed;
+  }
+  // Sends idled or resumed to every idle notification and returns once
+  // they are queued for the client, so a wl_display_roundtrip() after it
+  // delivers them.
+  void setSeatIdle(bool idle);
+
+private:
+  static int handleStop(int fd, uint32_t mask, void *data);
+  static int handleSeat(int fd, uint32_t mask, void *data);
+  static void bindIdleNotifier(wl_client *client, void *data,
+                               uint32_t version, uint32_t id);
+  static void createIdleNotification(wl_client *client,
+                                     wl_resource *resource, uint32_t id,
+                                     uint32_t timeout, wl_resource *seat);
+  static void destroyIdleNotification(wl_resource *resource);
+
+  wl_display *display = nullptr;
+  int peerFd = -1;
+  int stopFd = -1;
+  int seatFd = -1;
+  CompositorStats counters;
+  // Owned by the compositor thread.
+  std::vector<wl_resource *> idleNotifications;
+  bool seatIdle = false;
+  std::atomic<bool> wantSeatIdle{false};
+  std::atomic<uint64_t> seatRequests{0};
+  std::atomic<uint64_t> seatUpdates{0};
+  std::thread thread;
+};
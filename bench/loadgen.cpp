@@ -0,0 +1,357 @@
+#include "virtual_gamepad.h"
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Creates uinput controllers that look like the pads waypad expects and
+// drives them at a fixed report rate with one of a few input patterns.
+// Pointed at a running daemon with --watch PID, it also samples the
+// daemon's CPU time and context switches from /proc, so CPU per event and
+// wakeups per second can be compared as devices and rates scale.
+
+struct Profile {
+  const char *name;
+  uint16_t vendor;
+  uint16_t product;
+  int stickMin;
+  int stickMax;
+  int triggerMax;
+};
+
+static const Profile profiles[] = {
+    {"xbox", 0x045e, 0x028e, -32768, 32767, 1023},
+    {"dualsense", 0x054c, 0x0ce6, 0, 255, 255},
+};
+
+// Idle is sensor noise around the centre, drift walks the left stick off
+// centre over half a minute, bursty alternates two seconds of play with ten
+// of idle, and stress changes every axis and a button on every report.
+enum class Pattern { Idle, Drift, Bursty, Stress };
+
+#define BURST_PERIOD 12.0
+#define BURST_LENGTH 2.0
+#define DRIFT_MAX 0.15
+#define DRIFT_SECONDS 30.0
+#define NOISE 0.01f
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) { stopRequested = 1; }
+
+class PadDriver {
+public:
+  PadDriver(const Profile &profile, Pattern pattern, size_t index)
+      : profile(profile), pattern(pattern), rng(static_cast<uint32_t>(index)) {
+    input_absinfo absinfo[AXIS_COUNT] = {};
+    for (unsigned int code = ABS_X; code <= ABS_RZ; code++) {
+      bool trigger = code == ABS_Z || code == ABS_RZ;
+      absinfo[code].minimum = trigger ? 0 : profile.stickMin;
+      absinfo[code].maximum = trigger ? profile.triggerMax : profile.stickMax;
+      absinfo[code].value = trigger ? 0 : stickValue(0.0f);
+    }
+    pad = make_unique<VirtualGamepad>("waypad load " + to_string(index),
+                                      profile.vendor, profile.product,
+                                      absinfo);
+  }
+
+  // Emits one report; returns the number of events written.
+  size_t report(double seconds) {
+    events.clear();
+    switch (pattern) {
+    case Pattern::Idle:
+      rest(0.0f);
+      break;
+    case Pattern::Drift:
+      rest(static_cast<float>(DRIFT_MAX * min(1.0, seconds / DRIFT_SECONDS)));
+      break;
+    case Pattern::Bursty:
+      if (fmod(seconds, BURST_PERIOD) < BURST_LENGTH) {
+        play(seconds);
+      } else {
+        rest(0.0f);
+      }
+      break;
+    case Pattern::Stress:
+      stress();
+      break;
+    }
+    push(EV_SYN, SYN_REPORT, 0);
+    return pad->emit(events.data(), events.size()) ? events.size() : 0;
+  }
+
+  const string &devicePath() const { return pad->devicePath(); }
+
+private:
+  int stickValue(float position) const {
+    float unit = (position + 1.0f) / 2.0f;
+    return profile.stickMin +
+           static_cast<int>(lround(unit * (profile.stickMax - profile.stickMin)));
+  }
+
+  int triggerValue(float position) const {
+    return static_cast<int>(lround(position * profile.triggerMax));
+  }
+
+  void push(uint16_t type, uint16_t code, int32_t value) {
+    input_event ev = {};
+    ev.type = type;
+    ev.code = code;
+    ev.value = value;
+    events.push_back(ev);
+  }
+
+  void rest(float offset) {
+    uniform_real_distribution<float> noise(-NOISE, NOISE);
+    push(EV_ABS, ABS_X, stickValue(offset + noise(rng)));
+    push(EV_ABS, ABS_Y, stickValue(noise(rng)));
+    push(EV_ABS, ABS_RX, stickValue(noise(rng)));
+    push(EV_ABS, ABS_RY, stickValue(noise(rng)));
+    if (held) {
+      push(EV_KEY, held, 0);
+      held = 0;
+    }
+  }
+
+  void play(double seconds) {
+    float phase = static_cast<float>(seconds * 2.0 * M_PI);
+    push(EV_ABS, ABS_X, stickValue(0.9f * sinf(phase)));
+    push(EV_ABS, ABS_Y, stickValue(0.9f * cosf(phase)));
+    push(EV_ABS, ABS_RZ, triggerValue(0.5f + 0.5f * sinf(phase)));
+    // A different button every 100 ms, held for 50 ms of it.
+    long slot = static_cast<long>(seconds * 20.0);
+    uint16_t button = slot % 2 == 0 ? BTN_A + (slot / 2) % 11 : 0;
+    if (button != held) {
+      if (held) {
+        push(EV_KEY, held, 0);
+      }
+      if (button) {
+        push(EV_KEY, button, 1);
+      }
+      held = button;
+    }
+  }
+
+  void stress() {
+    uniform_real_distribution<float> stick(-1.0f, 1.0f);
+    uniform_real_distribution<float> trigger(0.0f, 1.0f);
+    push(EV_ABS, ABS_X, stickValue(stick(rng)));
+    push(EV_ABS, ABS_Y, stickValue(stick(rng)));
+    push(EV_ABS, ABS_RX, stickValue(stick(rng)));
+    push(EV_ABS, ABS_RY, stickValue(stick(rng)));
+    push(EV_ABS, ABS_Z, triggerValue(trigger(rng)));
+    push(EV_ABS, ABS_RZ, triggerValue(trigger(rng)));
+    uint16_t button = BTN_A + rng() % 11;
+    push(EV_KEY, button, held == button ? 0 : 1);
+    held = held == button ? 0 : button;
+  }
+
+  const Profile &profile;
+  Pattern pattern;
+  mt19937 rng;
+  uint16_t held = 0;
+  vector<input_event> events;
+  unique_ptr<VirtualGamepad> pad;
+};
+
+struct ProcessSample {
+  uint64_t cpuNs = 0;
+  uint64_t switches = 0;
+};
+
+// Sums every thread of the process: run time from schedstat and voluntary
+// plus involuntary context switches, each of which is one wakeup or
+// preemption.
+static bool sampleProcess(pid_t pid, ProcessSample &sample) {
+  sample = ProcessSample();
+  filesystem::path tasks = filesystem::path("/proc") / to_string(pid) / "task";
+  error_code ec;
+  bool found = false;
+  for (const auto &task : filesystem::directory_iterator(tasks, ec)) {
+    ifstream schedstat(task.path() / "schedstat");
+    uint64_t runNs = 0;
+    if (schedstat >> runNs) {
+      sample.cpuNs += runNs;
+      found = true;
+    }
+    ifstream status(task.path() / "status");
+    string line;
+    while (getline(status, line)) {
+      if (line.compare(0, 24, "voluntary_ctxt_switches:") == 0 ||
+          line.compare(0, 27, "nonvoluntary_ctxt_switches:") == 0) {
+        sample.switches += strtoull(line.c_str() + line.find(':') + 1,
+                                    nullptr, 10);
+      }
+    }
+  }
+  return found;
+}
+
+static bool parsePattern(const char *name, Pattern &pattern) {
+  if (strcmp(name, "idle") == 0) {
+    pattern = Pattern::Idle;
+  } else if (strcmp(name, "drift") == 0) {
+    pattern = Pattern::Drift;
+  } else if (strcmp(name, "bursty") == 0) {
+    pattern = Pattern::Bursty;
+  } else if (strcmp(name, "stress") == 0) {
+    pattern = Pattern::Stress;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static const Profile *findProfile(const char *name) {
+  for (const Profile &profile : profiles) {
+    if (strcmp(profile.name, name) == 0) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0
+       << " [--devices N] [--rate HZ] [--pattern idle|drift|bursty|stress]"
+          " [--profile xbox|dualsense] [--duration SECONDS] [--watch PID]"
+       << endl;
+}
+
+static timespec toTimespec(chrono::steady_clock::time_point time) {
+  auto ns = chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch())
+                .count();
+  timespec spec;
+  spec.tv_sec = ns / 1000000000;
+  spec.tv_nsec = ns % 1000000000;
+  return spec;
+}
+
+int main(int argc, char **argv) {
+  size_t deviceCount = 1;
+  double rate = 0;
+  double duration = 0;
+  Pattern pattern = Pattern::Bursty;
+  const Profile *profile = &profiles[0];
+  pid_t watchPid = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) {
+      deviceCount = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+      rate = strtod(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+      duration = strtod(argv[++i], nullptr);
+    } else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc &&
+               parsePattern(argv[i + 1], pattern)) {
+      i++;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc &&
+               findProfile(argv[i + 1])) {
+      profile = findProfile(argv[++i]);
+    } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+      watchPid = static_cast<pid_t>(strtol(argv[++i], nullptr, 10));
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+  // A USB polling rate for play, 8 kHz for the stress pattern.
+  if (rate <= 0) {
+    rate = pattern == Pattern::Stress ? 8000 : 250;
+  }
+
+  vector<unique_ptr<PadDriver>> pads;
+  try {
+    for (size_t i = 0; i < deviceCount; i++) {
+      pads.push_back(make_unique<PadDriver>(*profile, pattern, i));
+      cout << "Created " << profile->name << " controller at "
+           << pads.back()->devicePath() << endl;
+    }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+
+  signal(SIGINT, requestStop);
+  signal(SIGTERM, requestStop);
+
+  // Reports are scheduled on absolute ticks, so a late wakeup is caught up
+  // rather than stretching the rate; ticks that are already a full second
+  // behind are skipped and counted as late.
+  const auto interval = chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(1.0 / rate));
+  const auto start = chrono::steady_clock::now();
+  auto tick = start;
+  auto nextReport = start + chrono::seconds(1);
+  uint64_t reports = 0;
+  uint64_t events = 0;
+  uint64_t late = 0;
+  uint64_t lastEvents = 0;
+  uint64_t lastReports = 0;
+  ProcessSample lastSample;
+  bool watching = watchPid > 0 && sampleProcess(watchPid, lastSample);
+  if (watchPid > 0 && !watching) {
+    cerr << "Cannot read /proc/" << watchPid << ", not watching it" << endl;
+  }
+
+  while (!stopRequested) {
+    double seconds = chrono::duration<double>(tick - start).count();
+    if (duration > 0 && seconds >= duration) {
+      break;
+    }
+    for (auto &pad : pads) {
+      events += pad->report(seconds);
+    }
+    reports++;
+
+    tick += interval;
+    auto now = chrono::steady_clock::now();
+    if (now - tick > chrono::seconds(1)) {
+      late += (now - tick) / interval;
+      tick = now;
+    }
+    timespec wake = toTimespec(tick);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, nullptr) ==
+               EINTR &&
+           !stopRequested) {
+    }
+
+    if (now >= nextReport) {
+      cout << "t=" << static_cast<int>(seconds)
+           << "s reports/s=" << (reports - lastReports) * deviceCount
+           << " events/s=" << events - lastEvents << " late=" << late;
+      ProcessSample sample;
+      if (watching && sampleProcess(watchPid, sample)) {
+        uint64_t delta = events - lastEvents;
+        cout << " daemon ns/event="
+             << (delta ? static_cast<double>(sample.cpuNs - lastSample.cpuNs) /
+                             delta
+                       : 0.0)
+             << " daemon wakeups/s=" << sample.switches - lastSample.switches;
+        lastSample = sample;
+      }
+      cout << endl;
+      lastReports = reports;
+      lastEvents = events;
+      nextReport += chrono::seconds(1);
+    }
+  }
+
+  double elapsed =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  cout << "devices: " << deviceCount << ", reports: " << reports * deviceCount
+       << ", events: " << events << ", late ticks: " << late << ", "
+       << static_cast<uint64_t>(events / elapsed) << " events/s" << endl;
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "device_probe.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Times controller discovery the way the daemon does it at startup: every
+// event node in the input folder is classified, first one at a time, then
+// with the probe workers, then from a cache written by an earlier run the
+// way a restart would read it.
+
+using Clock = chrono::steady_clock;
+
+static double median(vector<double> values) {
+  if (values.empty()) {
+    return 0.0;
+  }
+  nth_element(values.begin(), values.begin() + values.size() / 2,
+              values.end());
+  return values[values.size() / 2];
+}
+
+static double timeScan(DeviceProbe &probe, const vector<string> &nodes,
+                       bool parallel, size_t &found) {
+  auto start = Clock::now();
+  vector<ProbeResult> results = probe.classify(nodes, parallel);
+  found = count(results.begin(), results.end(), ProbeResult::Gamepad);
+  return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0 << " [--dir PATH] [--runs N]" << endl;
+}
+
+int main(int argc, char **argv) {
+  filesystem::path inputFolder = "/dev/input";
+  size_t runs = 20;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      inputFolder = argv[++i];
+    } else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+      runs = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  vector<string> nodes;
+  error_code ec;
+  for (const auto &entry : filesystem::directory_iterator(inputFolder, ec)) {
+    if (entry.path().filename().string().compare(0, 5, "event") == 0) {
+      nodes.push_back(entry.path().string());
+    }
+  }
+  if (nodes.empty()) {
+    cerr << "No event nodes in " << inputFolder << endl;
+    return EXIT_FAILURE;
+  }
+
+  filesystem::path cacheFile = filesystem::temp_directory_path() /
+                               ("waypad-probe-" + to_string(getpid()));
+  vector<double> serial, parallel, cached;
+  size_t found = 0;
+  size_t timedOut = 0;
+  bool saved = true;
+  for (size_t run = 0; run < runs; run++) {
+    DeviceProbe serialProbe((filesystem::path()));
+    serial.push_back(timeScan(serialProbe, nodes, false, found));
+    DeviceProbe parallelProbe(cacheFile);
+    parallel.push_back(timeScan(parallelProbe, nodes, true, found));
+    timedOut += serialProbe.stats().timedOut + parallelProbe.stats().timedOut;
+    saved &= parallelProbe.save();
+    DeviceProbe restarted(cacheFile);
+    cached.push_back(timeScan(restarted, nodes, true, found));
+    filesystem::remove(cacheFile, ec);
+  }
+
+  cout << "event nodes:         " << nodes.size() << endl;
+  cout << "gamepads:            " << found << endl;
+  cout << "serial ms:           " << median(serial) << endl;
+  cout << "parallel ms:         " << median(parallel) << endl;
+  cout << "cached ms:           " << median(cached) << endl;
+  if (timedOut > 0) {
+    cout << "timed out probes:    " << timedOut << endl;
+  }
+  if (!saved) {
+    cerr << "Failed to write " << cacheFile << endl;
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
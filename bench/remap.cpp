@@ -0,0 +1,227 @@
+#include "remapper.h"
+#include "virtual_gamepad.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Measures what remapping adds on top of reading a controller. The default
+// run pushes synthetic reports through GamepadModel and a Remapper writing
+// to /dev/null and times the translation itself. With --uinput the whole
+// path is real: a uinput pad is read by a grabbed Gamepad, translated, and
+// the kernel timestamp of the emitted key is compared with the timestamp
+// of the button press that caused it.
+
+using Clock = chrono::steady_clock;
+
+static input_absinfo makeAbsInfo(int minimum, int maximum) {
+  input_absinfo info = {};
+  info.minimum = minimum;
+  info.maximum = maximum;
+  return info;
+}
+
+static void makeAbsInfo(input_absinfo (&absinfo)[AXIS_COUNT]) {
+  for (unsigned int code = ABS_X; code <= ABS_RZ; code++) {
+    absinfo[code] = code == ABS_Z || code == ABS_RZ
+                        ? makeAbsInfo(0, 1023)
+                        : makeAbsInfo(-32768, 32767);
+  }
+}
+
+static input_event makeEvent(uint16_t type, uint16_t code, int32_t value) {
+  input_event ev = {};
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+  return ev;
+}
+
+static uint32_t percentile(vector<uint32_t> &values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static void printLatency(const char *label, vector<uint32_t> &latency) {
+  cout << label << " p50 ns: " << percentile(latency, 0.50) << endl;
+  cout << label << " p99 ns: " << percentile(latency, 0.99) << endl;
+  cout << label << " max ns: " << percentile(latency, 1.0) << endl;
+}
+
+// Every report sweeps both sticks and the right trigger and toggles a
+// button, so all of the translation paths run on every report.
+static bool runInMemory(const RemapTable &table, size_t reports) {
+  int sink = open("/dev/null", O_WRONLY | O_CLOEXEC);
+  if (sink == -1) {
+    cerr << "Failed to open /dev/null: " << strerror(errno) << endl;
+    return false;
+  }
+  input_absinfo absinfo[AXIS_COUNT];
+  makeAbsInfo(absinfo);
+  GamepadModel model(absinfo);
+  Remapper remapper(table, sink);
+
+  vector<uint32_t> latency;
+  latency.reserve(reports);
+  input_event report[8];
+  for (size_t i = 0; i < reports; i++) {
+    float phase = static_cast<float>(i) * 0.01f;
+    int32_t x = static_cast<int32_t>(32767 * sinf(phase));
+    int32_t y = static_cast<int32_t>(32767 * cosf(phase));
+    report[0] = makeEvent(EV_ABS, ABS_X, x);
+    report[1] = makeEvent(EV_ABS, ABS_Y, y);
+    report[2] = makeEvent(EV_ABS, ABS_RX, y);
+    report[3] = makeEvent(EV_ABS, ABS_RY, x);
+    report[4] = makeEvent(EV_ABS, ABS_RZ, static_cast<int32_t>(i % 1024));
+    report[5] = makeEvent(EV_KEY, BTN_A + i % 11, 1);
+    report[6] = makeEvent(EV_KEY, BTN_A + (i + 10) % 11, 0);
+    report[7] = makeEvent(EV_SYN, SYN_REPORT, 0);
+
+    auto start = Clock::now();
+    for (const input_event &ev : report) {
+      model.applyEvent(ev);
+      remapper.translate(ev, *model.profile);
+    }
+    remapper.flush(model, start);
+    model.classify();
+    latency.push_back(static_cast<uint32_t>(
+        chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start)
+            .count()));
+  }
+  close(sink);
+
+  cout << "reports:                " << reports << endl;
+  printLatency("translate+write", latency);
+  return true;
+}
+
+static bool waitReadable(int fd) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  return poll(&pfd, 1, 1000) == 1;
+}
+
+// Waits for the report carrying key and returns its kernel timestamp.
+static bool readKey(int fd, uint16_t key, Clock::time_point &time) {
+  input_event events[RAW_BATCH_EVENTS];
+  while (waitReadable(fd)) {
+    ssize_t length = read(fd, events, sizeof(events));
+    if (length <= 0) {
+      return false;
+    }
+    for (size_t i = 0; i < length / sizeof(input_event); i++) {
+      if (events[i].type == EV_KEY && events[i].code == key) {
+        time = eventTime(events[i]);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+static bool runUinput(const RemapTable &table, size_t presses) {
+  input_absinfo absinfo[AXIS_COUNT];
+  makeAbsInfo(absinfo);
+  VirtualGamepad pad("waypad remap bench", 0x045e, 0x028e, absinfo);
+  if (!waitForNode(pad.devicePath())) {
+    cerr << pad.devicePath() << " did not appear" << endl;
+    return false;
+  }
+  Gamepad gamepad(pad.devicePath(), InputBackend::Raw);
+  gamepad.remapper = make_unique<Remapper>(table);
+  if (libevdev_grab(gamepad.evdev.get(), LIBEVDEV_GRAB) < 0) {
+    cerr << "Failed to grab " << pad.devicePath() << endl;
+    return false;
+  }
+  const string outputPath = gamepad.remapper->devicePath();
+  waitForNode(outputPath);
+  int output = open(outputPath.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  int clock = CLOCK_MONOTONIC;
+  if (output == -1 || ioctl(output, EVIOCSCLOCKID, &clock) != 0) {
+    cerr << "Failed to open " << outputPath << ": " << strerror(errno)
+         << endl;
+    if (output != -1) {
+      close(output);
+    }
+    return false;
+  }
+
+  // BTN_A is mapped in every built-in profile.
+  const uint16_t key = table.profile.buttons[0];
+  vector<uint32_t> latency;
+  latency.reserve(presses);
+  bool ok = true;
+  for (size_t i = 0; ok && i < presses * 2; i++) {
+    input_event press[2] = {makeEvent(EV_KEY, BTN_A, i % 2 == 0),
+                            makeEvent(EV_SYN, SYN_REPORT, 0)};
+    bool activity = false;
+    Clock::time_point out;
+    ok = pad.emit(press, 2) && waitReadable(gamepad.fd()) &&
+         gamepad.updateState(activity) && readKey(output, key, out);
+    if (ok && i % 2 == 0) {
+      latency.push_back(static_cast<uint32_t>(
+          chrono::duration_cast<chrono::nanoseconds>(out - gamepad.inputTime)
+              .count()));
+    }
+  }
+  close(output);
+  if (!ok) {
+    cerr << "Lost a press after " << latency.size() << " of " << presses
+         << endl;
+    return false;
+  }
+
+  cout << "presses:                " << presses << endl;
+  printLatency("kernel in->out", latency);
+  return true;
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0
+       << " [--profile desktop|wasd] [--reports N] [--uinput]" << endl;
+}
+
+int main(int argc, char **argv) {
+  const RemapProfile *profile = findRemapProfile("desktop");
+  size_t reports = 1000000;
+  bool uinput = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc &&
+        (profile = findRemapProfile(argv[i + 1]))) {
+      i++;
+    } else if (strcmp(argv[i], "--reports") == 0 && i + 1 < argc) {
+      reports = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--uinput") == 0) {
+      uinput = true;
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  RemapTable table(*profile);
+  try {
+    bool ok = uinput ? runUinput(table, min<size_t>(reports, 10000))
+                     : runInMemory(table, reports);
+    return ok ? 0 : EXIT_FAILURE;
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+}
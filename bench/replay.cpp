@@ -0,0 +1,317 @@
+#include "gamepad.h"
+#include "recording.h"
+#include "virtual_gamepad.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Pushes a recorded or synthetic event stream through GamepadModel, the
+// same decoding and activity code the daemon runs, as fast as possible.
+// A report (everything up to SYN_REPORT) is the unit the daemon classifies
+// after draining a device, so decision latency is measured per report.
+
+struct ReplayResult {
+  size_t events = 0;
+  size_t reports = 0;
+  size_t activations = 0;
+  chrono::nanoseconds elapsed{0};
+  vector<uint32_t> reportLatency;
+};
+
+static vector<GamepadModel> makeModels(const Recording &recording) {
+  uint16_t maxId = 0;
+  for (const RecordedDevice &device : recording.devices) {
+    maxId = max(maxId, device.device);
+  }
+  vector<GamepadModel> models(recording.devices.empty() ? 0 : maxId + 1);
+  for (const RecordedDevice &device : recording.devices) {
+    models[device.device] = GamepadModel(
+        device.absinfo, findControllerProfile(device.vendor, device.product));
+  }
+  return models;
+}
+
+// The decoder as it was before controller profiles: fixed BTN_A..BTN_THUMBR
+// and ABS_X..ABS_RZ ranges and branches per event type, writing the same
+// state. Kept as the baseline the profile tables are timed against.
+static void setButton(GamepadModel &model, unsigned int bit, bool down) {
+  uint64_t mask = uint64_t(1) << bit;
+  model.state.buttons =
+      down ? model.state.buttons | mask : model.state.buttons & ~mask;
+  model.pressed |= down;
+}
+
+static void applyEventBranches(GamepadModel &model, const input_event &ev) {
+  if (ev.type == EV_KEY) {
+    unsigned int bit = ev.code - BTN_A;
+    unsigned int dpad = ev.code - BTN_DPAD_UP;
+    if (bit <= BTN_THUMBR - BTN_A) {
+      setButton(model, bit, ev.value != 0);
+    } else if (dpad <= BTN_DPAD_RIGHT - BTN_DPAD_UP) {
+      setButton(model, DPAD_BIT + dpad, ev.value != 0);
+    } else if (ev.code == BTN_TOUCH) {
+      model.pressed |= ev.value != 0;
+    }
+  } else if (ev.type == EV_ABS) {
+    if (ev.code <= ABS_RZ) {
+      const AxisScale &axis = model.axisScales[ev.code];
+      model.state.axes[ev.code] = ev.value * axis.scale + axis.offset;
+    } else if (ev.code == ABS_HAT0X || ev.code == ABS_HAT0Y) {
+      unsigned int negative = DPAD_BIT + (ev.code == ABS_HAT0X ? 2 : 0);
+      setButton(model, negative, ev.value < 0);
+      setButton(model, negative + 1, ev.value > 0);
+    } else if (ev.code >= ABS_MT_SLOT) {
+      model.pressed = true;
+    }
+  } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+    model.reports++;
+  }
+}
+
+template <bool profiles>
+static size_t runThroughput(const Recording &recording,
+                            vector<GamepadModel> &models) {
+  size_t activations = 0;
+  vector<uint8_t> wasActive(models.size(), 0);
+  for (const RecordedEvent &recorded : recording.events) {
+    if (recorded.device >= models.size()) {
+      continue;
+    }
+    GamepadModel &model = models[recorded.device];
+    input_event ev = toInputEvent(recorded);
+    if (profiles) {
+      model.applyEvent(ev);
+    } else {
+      applyEventBranches(model, ev);
+    }
+    if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+      bool active = model.classify();
+      activations += active && !wasActive[recorded.device];
+      wasActive[recorded.device] = active;
+    }
+  }
+  return activations;
+}
+
+static void runLatency(const Recording &recording,
+                       vector<GamepadModel> &models, ReplayResult &result) {
+  result.reportLatency.reserve(recording.events.size() / 2);
+  auto reportStart = chrono::steady_clock::now();
+  bool inReport = false;
+  for (const RecordedEvent &recorded : recording.events) {
+    if (recorded.device >= models.size()) {
+      continue;
+    }
+    if (!inReport) {
+      reportStart = chrono::steady_clock::now();
+      inReport = true;
+    }
+    GamepadModel &model = models[recorded.device];
+    input_event ev = toInputEvent(recorded);
+    model.applyEvent(ev);
+    if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+      model.classify();
+      auto decided = chrono::steady_clock::now();
+      result.reportLatency.push_back(static_cast<uint32_t>(
+          chrono::duration_cast<chrono::nanoseconds>(decided - reportStart)
+              .count()));
+      inReport = false;
+    }
+  }
+}
+
+// Replays the stream through real kernel event nodes: one uinput pad per
+// recorded device, each opened once per backend. Events are injected a few
+// reports at a time, which stays well inside the evdev client buffer, and
+// after each chunk every reader of one backend drains its node while timed.
+// Both backends see exactly the same events.
+#define BACKEND_CHUNK_REPORTS 8
+
+struct BackendTarget {
+  unique_ptr<VirtualGamepad> pad;
+  unique_ptr<Gamepad> readers[2];
+  vector<input_event> pending;
+};
+
+static bool runBackends(const Recording &recording) {
+  static const InputBackend backends[2] = {InputBackend::Libevdev,
+                                           InputBackend::Raw};
+  static const char *const backendNames[2] = {"libevdev", "raw"};
+
+  vector<BackendTarget> targets;
+  try {
+    uint16_t maxId = 0;
+    for (const RecordedDevice &device : recording.devices) {
+      maxId = max(maxId, device.device);
+    }
+    targets.resize(maxId + 1);
+    for (const RecordedDevice &device : recording.devices) {
+      BackendTarget &target = targets[device.device];
+      target.pad = make_unique<VirtualGamepad>(
+          "waypad replay " + to_string(device.device), device.vendor,
+          device.product, device.absinfo);
+      waitForNode(target.pad->devicePath());
+      for (int b = 0; b < 2; b++) {
+        target.readers[b] =
+            make_unique<Gamepad>(target.pad->devicePath(), backends[b]);
+      }
+      target.pending.reserve(BACKEND_CHUNK_REPORTS * 16);
+    }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return false;
+  }
+
+  chrono::nanoseconds elapsed[2] = {};
+  size_t events = 0;
+  size_t reports = 0;
+  auto drain = [&]() {
+    for (BackendTarget &target : targets) {
+      if (target.pad && !target.pending.empty()) {
+        target.pad->emit(target.pending.data(), target.pending.size());
+        events += target.pending.size();
+        target.pending.clear();
+      }
+    }
+    for (int b = 0; b < 2; b++) {
+      auto start = chrono::steady_clock::now();
+      for (BackendTarget &target : targets) {
+        if (target.pad) {
+          bool activity;
+          target.readers[b]->updateState(activity);
+        }
+      }
+      elapsed[b] += chrono::steady_clock::now() - start;
+    }
+  };
+
+  for (const RecordedEvent &recorded : recording.events) {
+    if (recorded.device >= targets.size() || !targets[recorded.device].pad) {
+      continue;
+    }
+    targets[recorded.device].pending.push_back(toInputEvent(recorded));
+    if (recorded.type == EV_SYN && recorded.code == SYN_REPORT &&
+        ++reports % BACKEND_CHUNK_REPORTS == 0) {
+      drain();
+    }
+  }
+  drain();
+
+  for (int b = 0; b < 2; b++) {
+    cout << backendNames[b] << " ns/event: "
+         << static_cast<double>(elapsed[b].count()) / events << endl;
+  }
+  return true;
+}
+
+static uint32_t percentile(vector<uint32_t> &values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0
+       << " [--synthetic EVENTS] [--devices N] [--iterations N] [--uinput]"
+          " [FILE]"
+       << endl;
+}
+
+int main(int argc, char **argv) {
+  string path;
+  size_t syntheticEvents = 1000000;
+  size_t deviceCount = 1;
+  size_t iterations = 10;
+  bool uinput = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--synthetic") == 0 && i + 1 < argc) {
+      syntheticEvents = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) {
+      deviceCount = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--uinput") == 0) {
+      uinput = true;
+    } else if (argv[i][0] != '-' && path.empty()) {
+      path = argv[i];
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  Recording recording;
+  try {
+    recording = path.empty() ? synthesizeRecording(syntheticEvents, deviceCount)
+                             : loadRecording(path);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  if (recording.events.empty()) {
+    cerr << "Nothing to replay" << endl;
+    return EXIT_FAILURE;
+  }
+
+  ReplayResult result;
+  chrono::nanoseconds branchesElapsed{0};
+  size_t branchesActivations = 0;
+  for (size_t i = 0; i < iterations; i++) {
+    vector<GamepadModel> models = makeModels(recording);
+    auto start = chrono::steady_clock::now();
+    result.activations += runThroughput<true>(recording, models);
+    result.elapsed += chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start);
+    result.events += recording.events.size();
+
+    models = makeModels(recording);
+    start = chrono::steady_clock::now();
+    branchesActivations += runThroughput<false>(recording, models);
+    branchesElapsed += chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - start);
+  }
+
+  vector<GamepadModel> models = makeModels(recording);
+  runLatency(recording, models, result);
+  result.reports = result.reportLatency.size();
+
+  double seconds = result.elapsed.count() / 1e9;
+  cout << "source:          " << (path.empty() ? "synthetic" : path) << endl;
+  cout << "devices:         " << recording.devices.size() << endl;
+  cout << "events:          " << recording.events.size() << " x "
+       << iterations << endl;
+  cout << "activations:     " << result.activations / iterations << endl;
+  cout << "events/sec:      " << static_cast<uint64_t>(result.events / seconds)
+       << endl;
+  cout << "ns/event:        "
+       << static_cast<double>(result.elapsed.count()) / result.events << endl;
+  cout << "branches ns/ev:  "
+       << static_cast<double>(branchesElapsed.count()) / result.events;
+  if (branchesActivations != result.activations) {
+    cout << " (" << branchesActivations / iterations << " activations)";
+  }
+  cout << endl;
+  cout << "reports:         " << result.reports << endl;
+  cout << "decision p50 ns: " << percentile(result.reportLatency, 0.50)
+       << endl;
+  cout << "decision p99 ns: " << percentile(result.reportLatency, 0.99)
+       << endl;
+  cout << "decision max ns: " << percentile(result.reportLatency, 1.0)
+       << endl;
+
+  if (uinput && !runBackends(recording)) {
+    return EXIT_FAILURE;
+  }
+  return 0;
+}
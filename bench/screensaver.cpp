@@ -0,0 +1,202 @@
+#include "fake_screensaver.h"
+#include "inhibit_backend.h"
+#include "inhibitor.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <poll.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Runs Inhibitor and DBusInhibitBackend against FakeScreenSaver answering
+// Inhibit only after a delay. Scenarios check which calls reach the
+// service, in particular that a release requested before the cookie
+// arrived still goes out once it does and that one destroyed before its
+// cookie arrived is still released, and that a service which never
+// answers only holds up the exit for a bounded time. Every backend call, opening the
+// backend included, is timed to show the loop never waits for the service.
+// Run it under dbus-run-session so it gets a bus of its own.
+
+using Clock = chrono::steady_clock;
+
+// The daemon's loop around the backend: prepare, sleep on the bus fd,
+// dispatch. Returns the longest any single call took.
+static Clock::duration pump(InhibitBackend &backend, Clock::duration length) {
+  Clock::duration longest{};
+  auto timed = [&](auto call) {
+    auto start = Clock::now();
+    bool ok = call();
+    longest = max(longest, Clock::now() - start);
+    return ok;
+  };
+  auto deadline = Clock::now() + length;
+  while (Clock::now() < deadline) {
+    if (!timed([&] { return backend.prepare(); })) {
+      break;
+    }
+    struct pollfd pfd = {backend.fd(), POLLIN, 0};
+    auto remaining =
+        chrono::duration_cast<chrono::milliseconds>(deadline - Clock::now());
+    int ready = poll(&pfd, 1, max<int>(1, remaining.count()));
+    if (!timed([&] { return backend.dispatch(ready > 0); })) {
+      break;
+    }
+  }
+  return longest;
+}
+
+struct Scenario {
+  const char *name;
+  double replyDelay;
+  // Desired inhibitor state at each step, flushed one loop iteration
+  // apart.
+  vector<bool> steps;
+  vector<string> expected;
+  // Destroys the backend before any reply can arrive; expected then
+  // includes what the destructor sends.
+  bool destroyEarly = false;
+};
+
+static bool runScenario(FakeScreenSaver &service, const Scenario &scenario,
+                        Clock::duration &longest) {
+  auto replyDelay = chrono::duration_cast<Clock::duration>(
+      chrono::duration<double>(scenario.replyDelay));
+  service.setReplyDelay(replyDelay);
+  auto start = Clock::now();
+  unique_ptr<DBusInhibitBackend> backend = DBusInhibitBackend::create();
+  longest = max(longest, Clock::now() - start);
+  if (!backend) {
+    cerr << scenario.name << ": failed to open the backend" << endl;
+    return false;
+  }
+  InhibitConfig config;
+  config.idleTimeout = chrono::seconds(1);
+  config.log = false;
+  Clock::time_point now;
+  Inhibitor inhibitor(backend.get(), config, now);
+  for (bool inhibit : scenario.steps) {
+    now += chrono::seconds(2);
+    if (inhibit) {
+      inhibitor.onActivity(now, now);
+    } else {
+      inhibitor.update(now);
+    }
+    auto start = Clock::now();
+    inhibitor.flush();
+    longest = max(longest, Clock::now() - start);
+    longest = max(longest, pump(*backend, chrono::milliseconds(5)));
+  }
+  vector<string> calls;
+  if (!scenario.destroyEarly) {
+    // Long enough for every delayed reply and what follows it.
+    longest =
+        max(longest, pump(*backend, replyDelay + chrono::milliseconds(100)));
+    calls = service.takeCalls();
+  }
+  // Whatever is still held is released by the destructor, which flushes
+  // before it returns.
+  backend.reset();
+  this_thread::sleep_for(chrono::milliseconds(50));
+  vector<string> late = service.takeCalls();
+  if (scenario.destroyEarly) {
+    calls = move(late);
+  }
+  bool ok = calls == scenario.expected;
+  if (service.activeInhibitions() != 0) {
+    cout << "  left an inhibition behind" << endl;
+    ok = false;
+  }
+  cout << (ok ? "PASS " : "FAIL ") << scenario.name << ":";
+  for (const string &call : calls) {
+    cout << " [" << call << "]";
+  }
+  cout << endl;
+  if (!ok) {
+    cout << "  expected:";
+    for (const string &call : scenario.expected) {
+      cout << " [" << call << "]";
+    }
+    cout << endl;
+  }
+  return ok;
+}
+
+int main() {
+  FakeScreenSaver service;
+  if (!service.start()) {
+    return EXIT_FAILURE;
+  }
+
+  // Cookies keep counting across scenarios since the service lives on.
+  const vector<Scenario> scenarios = {
+      {"prompt reply", 0.0, {true, false}, {"Inhibit 1", "UnInhibit 1"}},
+      {"release before cookie",
+       0.2,
+       {true, false},
+       {"Inhibit 2", "UnInhibit 2"}},
+      {"flap before cookie", 0.2, {true, false, true}, {"Inhibit 3"}},
+      {"held at exit", 0.0, {true}, {"Inhibit 4"}},
+      {"destroyed before cookie",
+       0.2,
+       {true},
+       {"Inhibit 5", "UnInhibit 5"},
+       true},
+  };
+
+  bool ok = true;
+  Clock::duration longest{};
+  for (const Scenario &scenario : scenarios) {
+    ok &= runScenario(service, scenario, longest);
+  }
+
+  // A service that took the name but never answers Inhibit must not keep
+  // the destructor waiting past its deadline.
+  service.setReplyDelay(chrono::hours(1));
+  unique_ptr<DBusInhibitBackend> stuck = DBusInhibitBackend::create();
+  bool stuckOk = stuck && stuck->waitForService();
+  if (stuckOk) {
+    stuck->inhibit();
+    pump(*stuck, chrono::milliseconds(5));
+    auto start = Clock::now();
+    stuck.reset();
+    auto waited = Clock::now() - start;
+    stuckOk = waited < chrono::seconds(5);
+    cout << (stuckOk ? "PASS " : "FAIL ") << "never answered at exit: "
+         << chrono::duration_cast<chrono::milliseconds>(waited).count()
+         << " ms" << endl;
+  } else {
+    cout << "FAIL never answered at exit: failed to open the backend"
+         << endl;
+  }
+  ok &= stuckOk;
+  service.stop();
+
+  // With the service gone the check made at startup fails, and so does a
+  // backend opened from the loop once the bus has answered.
+  unique_ptr<DBusInhibitBackend> orphan = DBusInhibitBackend::create();
+  bool missingOk = orphan && !orphan->waitForService();
+  orphan = DBusInhibitBackend::create();
+  if (orphan) {
+    orphan->inhibit();
+    missingOk &= pump(*orphan, chrono::seconds(1)) < chrono::milliseconds(50);
+    missingOk &= !orphan->dispatch(false);
+  } else {
+    missingOk = false;
+  }
+  cout << (missingOk ? "PASS " : "FAIL ") << "service missing" << endl;
+  ok &= missingOk;
+
+  cout << "longest backend call: "
+       << chrono::duration_cast<chrono::microseconds>(longest).count()
+       << " us (slowest reply 200000 us)" << endl;
+  // Anything near the reply delay means a call waited for the service.
+  if (longest >= chrono::milliseconds(50)) {
+    cout << "FAIL a backend call blocked" << endl;
+    ok = false;
+  }
+  return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,290 @@
+#include "gamepad.h"
+#include "headless_compositor.h"
+#include "inhibit_backend.h"
+#include "inhibitor.h"
+#include "wayland.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Runs the real Inhibitor and wlContext code against HeadlessCompositor.
+// Scenarios replay input timelines on a virtual clock and check exactly
+// which requests reach the compositor, so state machine changes can be
+// verified in a container without a session. The latency run then drives
+// synthetic button presses through GamepadModel on the real clock and
+// measures how long the compositor takes to see the inhibitor.
+
+using Clock = chrono::steady_clock;
+
+// Exit status for a sandbox that cannot host the compositor at all, which
+// CTest reports as skipped rather than failed.
+#define EXIT_SKIPPED 77
+
+struct Session {
+  HeadlessCompositor compositor;
+  wlContext context;
+  WaylandInhibitBackend backend{context};
+  uint64_t baseRequests = 0;
+
+  explicit Session(bool watchSeat = false) {
+    if (!connectToWayland(context, compositor.clientFd())) {
+      throw runtime_error("Failed to connect to the headless compositor");
+    }
+    if (watchSeat && !watchSeatIdle(context, chrono::seconds(60))) {
+      throw runtime_error("The headless compositor has no idle notifier");
+    }
+    wl_display_roundtrip(context.display);
+    baseRequests = compositor.stats().requests;
+  }
+  ~Session() { clean(context); }
+  uint64_t requests() const {
+    return compositor.stats().requests - baseRequests;
+  }
+};
+
+struct Scenario {
+  const char *name;
+  double idleTimeout;
+  double activationDelay;
+  double releaseGrace;
+  vector<double> input;
+  uint64_t expectedRequests;
+  uint64_t expectedInhibits;
+  // With --idle-notify, when the compositor reports the seat idle (true)
+  // or in use again (false).
+  bool waitForSeatIdle = false;
+  vector<pair<double, bool>> seat = {};
+};
+
+static Clock::duration seconds(double value) {
+  return chrono::duration_cast<Clock::duration>(
+      chrono::duration<double>(value));
+}
+
+// Input every interval seconds from start to end inclusive, as a held
+// stick would produce.
+static vector<double> burst(double start, double end, double interval,
+                            vector<double> times = {}) {
+  for (double t = start; t <= end + 1e-9; t += interval) {
+    times.push_back(t);
+  }
+  return times;
+}
+
+static bool runScenario(const Scenario &scenario) {
+  Session session(scenario.waitForSeatIdle);
+  InhibitConfig config;
+  config.idleTimeout = seconds(scenario.idleTimeout);
+  config.activationDelay = seconds(scenario.activationDelay);
+  config.releaseGrace = seconds(scenario.releaseGrace);
+  config.waitForSeatIdle = scenario.waitForSeatIdle;
+  config.log = false;
+
+  // The same wakeup order as the daemon: deliver whichever comes first of
+  // the next input, the next seat report or the inhibitor's deadline, then
+  // flush once.
+  const Clock::time_point start;
+  Inhibitor inhibitor(&session.backend, config, start);
+  size_t next = 0;
+  size_t nextSeat = 0;
+  while (true) {
+    Clock::time_point deadline = inhibitor.deadline();
+    bool haveInput = next < scenario.input.size();
+    Clock::time_point inputAt =
+        haveInput ? start + seconds(scenario.input[next]) : Clock::time_point();
+    bool haveSeat = nextSeat < scenario.seat.size();
+    Clock::time_point seatAt =
+        haveSeat ? start + seconds(scenario.seat[nextSeat].first)
+                 : Clock::time_point();
+    if (haveSeat && (!haveInput || seatAt <= inputAt) && seatAt <= deadline) {
+      // The report travels through the real protocol objects.
+      session.compositor.setSeatIdle(scenario.seat[nextSeat].second);
+      wl_display_roundtrip(session.context.display);
+      session.context.seat_idle_changed = false;
+      inhibitor.setSeatIdle(session.context.seat_idle);
+      inhibitor.update(seatAt);
+      nextSeat++;
+    } else if (haveInput && inputAt <= deadline) {
+      inhibitor.onActivity(inputAt, inputAt);
+      next++;
+    } else if (deadline != Clock::time_point::max()) {
+      inhibitor.update(deadline);
+    } else {
+      break;
+    }
+    inhibitor.flush();
+    wl_display_flush(session.context.display);
+  }
+  wl_display_roundtrip(session.context.display);
+
+  const CompositorStats &stats = session.compositor.stats();
+  bool pass = session.requests() == scenario.expectedRequests &&
+              stats.inhibitorsCreated == scenario.expectedInhibits &&
+              !session.compositor.isInhibited();
+  cout << (pass ? "PASS " : "FAIL ") << scenario.name
+       << ": requests=" << session.requests()
+       << " inhibits=" << stats.inhibitorsCreated
+       << " avoided=" << inhibitor.stats().requestsAvoided;
+  if (!pass) {
+    cout << " (expected requests=" << scenario.expectedRequests
+         << " inhibits=" << scenario.expectedInhibits << ")";
+  }
+  cout << endl;
+  return pass;
+}
+
+static input_absinfo makeAbsInfo(int minimum, int maximum) {
+  input_absinfo info = {};
+  info.minimum = minimum;
+  info.maximum = maximum;
+  return info;
+}
+
+static uint32_t percentile(vector<uint32_t> &values, double fraction) {
+  if (values.empty()) {
+    return 0;
+  }
+  size_t index = static_cast<size_t>(fraction * (values.size() - 1));
+  nth_element(values.begin(), values.begin() + index, values.end());
+  return values[index];
+}
+
+// One session per press: the press is decoded and classified, the
+// inhibitor is requested and flushed, and the compositor's receive time is
+// compared against the moment the report was complete. The controller
+// then goes idle so the next press starts from scratch.
+static bool runLatency(size_t sessions) {
+  Session session;
+  input_absinfo absinfo[AXIS_COUNT];
+  for (unsigned int code = ABS_X; code <= ABS_RZ; code++) {
+    absinfo[code] = code == ABS_Z || code == ABS_RZ
+                        ? makeAbsInfo(0, 1023)
+                        : makeAbsInfo(-32768, 32767);
+  }
+  GamepadModel model(absinfo);
+  InhibitConfig config;
+  config.log = false;
+  Inhibitor inhibitor(&session.backend, config, Clock::now());
+
+  vector<uint32_t> latency;
+  latency.reserve(sessions);
+  for (size_t i = 0; i < sessions; i++) {
+    input_event press[2] = {};
+    press[0].type = EV_KEY;
+    press[0].code = BTN_A + i % 11;
+    press[0].value = 1;
+    press[1].type = EV_SYN;
+    press[1].code = SYN_REPORT;
+
+    auto inputTime = Clock::now();
+    for (const input_event &ev : press) {
+      model.applyEvent(ev);
+    }
+    if (model.classify()) {
+      inhibitor.onActivity(Clock::now(), inputTime);
+    }
+    inhibitor.flush();
+    wl_display_flush(session.context.display);
+    wl_display_roundtrip(session.context.display);
+    int64_t received = session.compositor.stats().lastInhibitNs;
+    latency.push_back(static_cast<uint32_t>(
+        received - chrono::duration_cast<chrono::nanoseconds>(
+                       inputTime.time_since_epoch())
+                       .count()));
+
+    press[0].value = 0;
+    for (const input_event &ev : press) {
+      model.applyEvent(ev);
+    }
+    model.classify();
+    inhibitor.update(Clock::now() + config.idleTimeout);
+    inhibitor.flush();
+    wl_display_flush(session.context.display);
+  }
+  wl_display_roundtrip(session.context.display);
+
+  const CompositorStats &stats = session.compositor.stats();
+  if (stats.inhibitorsCreated != sessions) {
+    cerr << "Expected " << sessions << " inhibitors, compositor saw "
+         << stats.inhibitorsCreated << endl;
+    return false;
+  }
+  cout << "sessions:             " << sessions << endl;
+  cout << "requests/session:     "
+       << static_cast<double>(session.requests()) / sessions << endl;
+  cout << "input->inhibit p50 ns: " << percentile(latency, 0.50) << endl;
+  cout << "input->inhibit p99 ns: " << percentile(latency, 0.99) << endl;
+  cout << "input->inhibit max ns: " << percentile(latency, 1.0) << endl;
+  return true;
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0 << " [--sessions N] [--no-scenarios]" << endl;
+}
+
+int main(int argc, char **argv) {
+  size_t sessions = 1000;
+  bool scenarios = true;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--sessions") == 0 && i + 1 < argc) {
+      sessions = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--no-scenarios") == 0) {
+      scenarios = false;
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Every transition costs the create or destroy request plus a commit.
+  const vector<Scenario> all = {
+      {"single tap", 10, 0, 0, {1}, 4, 1},
+      {"continuous play", 10, 0, 0, burst(0, 60, 0.5), 4, 1},
+      {"bursty play", 10, 0, 0,
+       burst(26, 28, 0.5, burst(13, 15, 0.5, burst(0, 2, 0.5))), 12, 3},
+      {"bursty play with grace", 10, 0, 5,
+       burst(26, 28, 0.5, burst(13, 15, 0.5, burst(0, 2, 0.5))), 4, 1},
+      {"bump with activation delay", 10, 1, 0, {5}, 0, 0},
+      {"play with activation delay", 10, 1, 0, burst(0, 3, 0.1), 4, 1},
+      // With --idle-notify nothing is sent until the compositor says the
+      // seat has gone idle.
+      {"play while typing", 10, 0, 0, burst(0, 60, 0.5), 0, 0, true},
+      {"play until the seat idles", 10, 0, 0, burst(0, 60, 0.5), 4, 1, true,
+       {{20, true}}},
+      {"seat resumes while inhibited", 10, 0, 0, burst(0, 60, 0.5), 4, 1,
+       true, {{20, true}, {30, false}}},
+      {"seat idles after play", 10, 0, 0, burst(0, 5, 0.5), 0, 0, true,
+       {{30, true}}},
+  };
+
+  try {
+    HeadlessCompositor probe;
+  } catch (const exception &e) {
+    cout << "Skipped: " << e.what() << endl;
+    return EXIT_SKIPPED;
+  }
+
+  bool ok = true;
+  try {
+    if (scenarios) {
+      for (const Scenario &scenario : all) {
+        ok &= runScenario(scenario);
+      }
+    }
+    if (sessions > 0) {
+      ok &= runLatency(sessions);
+    }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
+  }
+  return ok ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,202 @@
+#include "state_snapshot.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+// Hammers the shared state region from one writer thread, publishing as
+// fast as the daemon's input path can, while reader threads poll it the way
+// an overlay would. Every publish writes the same counter into the button
+// mask and all axes, so a reader that ever sees them disagree has caught a
+// torn read and the run fails. The writer is far busier than any real
+// controller, so a reader now and then gives up on a block that never stops
+// changing. It also checks that a second writer cannot take over the
+// region while the first holds it. With --attach NAME it instead maps a
+// running daemon's region and prints what it finds.
+
+using Clock = chrono::steady_clock;
+
+static const SharedState *attach(const string &name) {
+  string object = name[0] == '/' ? name : "/" + name;
+  int fd = shm_open(object.c_str(), O_RDONLY | O_CLOEXEC, 0);
+  if (fd == -1) {
+    cerr << "Failed to open " << object << ": " << strerror(errno) << endl;
+    return nullptr;
+  }
+  void *memory =
+      mmap(nullptr, sizeof(SharedState), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (memory == MAP_FAILED) {
+    cerr << "Failed to map " << object << ": " << strerror(errno) << endl;
+    return nullptr;
+  }
+  auto *shared = static_cast<const SharedState *>(memory);
+  if (__atomic_load_n(&shared->magic, __ATOMIC_ACQUIRE) != SNAPSHOT_MAGIC ||
+      shared->version != SNAPSHOT_VERSION) {
+    cerr << object << " is not a waypad state region of version "
+         << SNAPSHOT_VERSION << endl;
+    return nullptr;
+  }
+  return shared;
+}
+
+static int printState(const string &name) {
+  const SharedState *shared = attach(name);
+  if (!shared) {
+    return EXIT_FAILURE;
+  }
+  int64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                    Clock::now().time_since_epoch())
+                    .count();
+  SnapshotInhibitorState inhibitor;
+  if (readSnapshot(shared->sequence, shared->inhibitor, inhibitor)) {
+    cout << "daemon pid " << inhibitor.pid << ", inhibiting: "
+         << (inhibitor.inhibiting ? "yes" : "no") << endl;
+  }
+  for (const SnapshotDevice &device : shared->devices) {
+    SnapshotDeviceState state;
+    if (!readSnapshot(device.sequence, device.state, state) ||
+        !(state.flags & SNAPSHOT_PRESENT)) {
+      continue;
+    }
+    cout << state.path << " (" << hex << state.vendor << ":" << state.product
+         << dec << ")" << (state.flags & SNAPSHOT_ACTIVE ? " active" : "")
+         << " buttons " << hex << state.buttons << dec << " axes";
+    for (float axis : state.axes) {
+      cout << " " << axis;
+    }
+    if (state.lastActivity != 0) {
+      cout << ", last input " << (now - state.lastActivity) / 1000000
+           << " ms ago";
+    }
+    cout << endl;
+  }
+  return 0;
+}
+
+struct ReaderResult {
+  uint64_t reads = 0;
+  uint64_t failed = 0;
+  uint64_t torn = 0;
+  chrono::nanoseconds elapsed{0};
+};
+
+static void runReader(const SharedState *shared, int slot,
+                      const atomic<bool> &stop, ReaderResult &result) {
+  const SnapshotDevice &device = shared->devices[slot];
+  auto start = Clock::now();
+  while (!stop.load(memory_order_relaxed)) {
+    SnapshotDeviceState state;
+    result.reads++;
+    if (!readSnapshot(device.sequence, device.state, state)) {
+      result.failed++;
+      continue;
+    }
+    float expected = static_cast<float>(state.buttons);
+    for (float axis : state.axes) {
+      result.torn += axis != expected;
+    }
+  }
+  result.elapsed = Clock::now() - start;
+}
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0
+       << " [--readers N] [--seconds S] | --attach NAME" << endl;
+}
+
+int main(int argc, char **argv) {
+  size_t readerCount = 2;
+  double seconds = 2.0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--attach") == 0 && i + 1 < argc) {
+      return printState(argv[i + 1]);
+    } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+      readerCount = max<size_t>(1, strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = max(0.1, strtod(argv[++i], nullptr));
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  string name = "/waypad-snapshot-" + to_string(getpid());
+  StateSnapshot snapshot;
+  if (!snapshot.open(name)) {
+    cerr << "Failed to create " << name << ": " << strerror(errno) << endl;
+    return EXIT_FAILURE;
+  }
+  // A second writer under the same name must be turned away rather than
+  // detach the live region.
+  StateSnapshot second;
+  if (second.open(name) || errno != EBUSY) {
+    cerr << "A second instance was allowed to replace " << name << endl;
+    return EXIT_FAILURE;
+  }
+  const SharedState *shared = attach(name);
+  if (!shared) {
+    return EXIT_FAILURE;
+  }
+  int slot = snapshot.acquire("bench", 0x045e, 0x028e, NodeRole::Buttons);
+
+  atomic<bool> stop{false};
+  vector<ReaderResult> results(readerCount);
+  vector<thread> readers;
+  for (size_t i = 0; i < readerCount; i++) {
+    readers.emplace_back(runReader, shared, slot, cref(stop),
+                         ref(results[i]));
+  }
+
+  GamepadModel model;
+  uint64_t publishes = 0;
+  auto start = Clock::now();
+  auto deadline = start + chrono::duration_cast<Clock::duration>(
+                              chrono::duration<double>(seconds));
+  while (Clock::now() < deadline) {
+    for (int i = 0; i < 1000; i++) {
+      publishes++;
+      // Wrapped so the value stays exact in a float.
+      uint64_t value = publishes & ((1 << 24) - 1);
+      model.state.buttons = value;
+      fill(begin(model.state.axes), end(model.state.axes),
+           static_cast<float>(value));
+      snapshot.publish(slot, model, publishes % 2 == 0, Clock::now());
+    }
+  }
+  auto elapsed = Clock::now() - start;
+  stop.store(true);
+  for (thread &reader : readers) {
+    reader.join();
+  }
+
+  ReaderResult total;
+  for (const ReaderResult &result : results) {
+    total.reads += result.reads;
+    total.failed += result.failed;
+    total.torn += result.torn;
+    total.elapsed += result.elapsed;
+  }
+  cout << "publishes:       " << publishes << endl;
+  cout << "publish ns:      "
+       << static_cast<double>(
+              chrono::duration_cast<chrono::nanoseconds>(elapsed).count()) /
+              publishes
+       << endl;
+  cout << "reads:           " << total.reads << endl;
+  cout << "read ns:         "
+       << static_cast<double>(total.elapsed.count()) / total.reads << endl;
+  cout << "gave up:         " << total.failed << endl;
+  cout << "torn reads:      " << total.torn << endl;
+  return total.torn == 0 ? 0 : EXIT_FAILURE;
+}
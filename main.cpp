@@ -1,305 +1,876 @@
-#include "include/idle-inhibit-unstable-v1-client-protocol.h"
+#include "device_registry.h"
+#include "diagnostics.h"
+#include "event_loop.h"
+#include "inhibit_backend.h"
+#include "inhibitor.h"
+#include "input_thread.h"
+#include "metrics.h"
+#include "recording.h"
+#include "remapper.h"
+#include "state_snapshot.h"
+#include "status_log.h"
+#include "wayland.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
 #include <chrono>
 #include <cstdlib>
 #include <cstring>
-#include <fcntl.h>
 #include <filesystem>
 #include <iostream>
-#include <libevdev-1.0/libevdev/libevdev.h>
-#include <linux/input-event-codes.h>
-#include <linux/input.h>
 #include <memory>
 #include <stdexcept>
 #include <string>
-#include <thread>
+#include <sys/signalfd.h>
 #include <unistd.h>
 #include <vector>
-#include <wayland-client-core.h>
-#include <wayland-client-protocol.h>
 
 using namespace std;
 
 #define THRESHOLD 10
+#define METRICS_INTERVAL 15
+// How long a seat whose compositor could not be reached waits before the
+// next attempt.
+#define RECONNECT_DELAY 5
+
+static void usage(const char *argv0) {
+  cerr << "Usage: " << argv0 << " [OPTIONS]\n"
+       << "  --timeout SECONDS           inactivity before the controller "
+          "counts as idle (default "
+       << THRESHOLD << ")\n"
+       << "  --activation-delay SECONDS  input needed before inhibiting\n"
+       << "  --release-grace SECONDS     keep the inhibitor this long past "
+          "the timeout\n"
+       << "  --backend libevdev|raw|io_uring\n"
+       << "  --inhibit auto|wayland|dbus\n"
+       << "  --idle-notify SECONDS       only inhibit once the compositor "
+          "has seen no keyboard\n"
+       << "                              or mouse input this long; set it "
+          "below its idle timeout\n"
+       << "  --input-thread              read controllers on their own "
+          "thread\n"
+       << "  --realtime                  run that thread with SCHED_FIFO\n"
+       << "  --remap desktop|wasd        grab controllers and emulate "
+          "keyboard and mouse\n"
+       << "  --motion-rate HZ            sample motion sensors this often "
+          "(default: ignore them)\n"
+       << "  --device PATH               also track this event node even if "
+          "it does not look like a controller\n"
+       << "  --record FILE               write every input event to FILE\n"
+       << "  --metrics-file FILE         write Prometheus metrics to FILE "
+          "every "
+       << METRICS_INTERVAL << "s\n"
+       << "  --metrics-socket PATH       serve Prometheus metrics on a Unix "
+          "socket\n"
+       << "  --state-shm NAME            publish live controller state in "
+          "/dev/shm/NAME\n"
+       << "  --exit-after SECONDS        start without controllers, connect "
+          "to the desktop when\n"
+       << "                              needed and exit this long after the "
+          "last one is gone\n"
+       << "  --seat NAME=DISPLAY         inhibit idle on DISPLAY for the "
+          "controllers udev assigns\n"
+       << "                              to seat NAME; repeat for every seat "
+          "to serve\n"
+       << "  --diagnose SECONDS          measure report rate, jitter, dropped "
+          "reports and axis\n"
+       << "                              noise of every controller, then "
+          "exit"
+       << endl;
+}
 
-struct wlContext {
-  struct wl_display *display = nullptr;
-  struct wl_compositor *compositor = nullptr;
-  struct wl_surface *surface = nullptr;
-  struct zwp_idle_inhibit_manager_v1 *idle_inhibit_manager = nullptr;
-  struct zwp_idle_inhibitor_v1 *idle_inhibitor = nullptr;
-};
-
-class Gamepad {
-public:
-  Gamepad(const string &path);
-  ~Gamepad();
-  void updateState();
-  bool isAnyButtonPressed() const;
-  bool isAxisMoved() const;
-  bool isAnyTriggerPressed() const;
-
-  string path;
-  unique_ptr<libevdev, void (*)(libevdev *)> evdev;
-  vector<bool> buttons;
-  vector<float> axes;
-  vector<float> triggers;
-};
-
-Gamepad::Gamepad(const string &path)
-    : evdev(nullptr, [](libevdev *dev) { libevdev_free(dev); }) {
-  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
-  if (fd == -1) {
-    throw runtime_error("Failed to open device: " + path);
+static bool parseRate(const char *text, double &out) {
+  char *end = nullptr;
+  double hz = strtod(text, &end);
+  if (end == text || *end != '\0' || hz <= 0 || hz > 1000) {
+    return false;
   }
-  libevdev *dev = nullptr;
+  out = hz;
+  return true;
+}
 
-  int rc = libevdev_new_from_fd(fd, &dev);
-  if (rc < 0) {
-    close(fd);
-    throw runtime_error("Failed to initialize libevdev");
+static bool parseSeconds(const char *text,
+                         chrono::steady_clock::duration &out) {
+  char *end = nullptr;
+  double seconds = strtod(text, &end);
+  if (end == text || *end != '\0' || seconds < 0) {
+    return false;
   }
+  out = chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(seconds));
+  return true;
+}
 
-  buttons.resize(BTN_THUMBR - BTN_A + 1, false);
-  axes.resize(ABS_RY - ABS_X + 1, 0.0f);
-  triggers.resize(ABS_RZ - ABS_Z + 1, 0.0f);
+// --idle-notify needs the compositor even when the inhibitor goes over
+// D-Bus, in which case the main loop runs the display's read cycle itself.
+static bool watchSeat(wlContext &context,
+                      chrono::steady_clock::duration timeout) {
+  if (!context.display && !connectToWayland(context)) {
+    return false;
+  }
+  if (!watchSeatIdle(context,
+                     chrono::duration_cast<chrono::milliseconds>(timeout))) {
+    cerr << "The compositor does not support ext-idle-notify-v1" << endl;
+    return false;
+  }
+  return true;
+}
 
-  evdev = unique_ptr<libevdev, void (*)(libevdev *)>(
-      dev, [](libevdev *dev) { libevdev_free(dev); });
+static bool ownsDisplay(const wlContext &context,
+                        const InhibitBackend &backend) {
+  return context.display &&
+         !dynamic_cast<const WaylandInhibitBackend *>(&backend);
 }
 
-Gamepad::~Gamepad() {}
-
-void Gamepad::updateState() {
-  struct input_event ev;
-  while (libevdev_next_event(evdev.get(), LIBEVDEV_READ_FLAG_NORMAL, &ev) ==
-         LIBEVDEV_READ_STATUS_SUCCESS) {
-    switch (ev.type) {
-    case EV_KEY:
-      if (ev.code >= BTN_A && ev.code <= BTN_THUMBR) {
-        /*cout << "button input" << endl;*/
-        buttons[ev.code - BTN_A] = ev.value != 0;
+// Reads controllers through the same registry and backend as the daemon,
+// without touching the desktop, and prints what the reports looked like.
+static int diagnose(chrono::steady_clock::duration length,
+                    InputBackend backend,
+                    const vector<string> &extraDevices) {
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+  int epollFd = epoll_create1(EPOLL_CLOEXEC);
+  int timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  int signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  Diagnostics diagnostics;
+  try {
+    if (epollFd == -1 || timerFd == -1 || signalFd == -1 ||
+        !addToEpoll(epollFd, timerFd, epollTag(EventSource::Timer)) ||
+        !addToEpoll(epollFd, signalFd, epollTag(EventSource::Signal))) {
+      throw runtime_error("Failed to create event loop: " +
+                          string(strerror(errno)));
+    }
+    DeviceRegistry registry(epollFd);
+    registry.setDiagnostics(&diagnostics);
+    registry.setBackend(backend);
+    if (!registry.watch("/dev/input")) {
+      cerr << "Failed to watch for controller hotplug: " << strerror(errno)
+           << endl;
+      registry.scan("/dev/input");
+    }
+    for (const string &path : extraDevices) {
+      if (!registry.contains(path)) {
+        registry.add(path);
       }
-      break;
-
-    case EV_ABS:
-      switch (ev.code) {
-      case ABS_X:
-      case ABS_Y:
-      case ABS_RX:
-      case ABS_RY: {
-        int maxValue = libevdev_get_abs_maximum(evdev.get(), ev.code);
-        int minValue = libevdev_get_abs_minimum(evdev.get(), ev.code);
-        if (maxValue > minValue) {
-          float range = static_cast<float>(maxValue - minValue);
-          /*cout << "axis movement" << endl;*/
-          axes[ev.code - ABS_X] = (ev.value - minValue) / range * 2.0f - 1.0f;
-        } else {
-          axes[ev.code - ABS_X] = 0.0f;
+    }
+    flushStatusLog();
+    // The kernel only forwards reports in which something changed, so a
+    // controller left alone looks like it has stopped reporting.
+    cout << "Measuring for " << chrono::duration<double>(length).count()
+         << " s; keep a stick moving, then leave the other controls at rest"
+         << endl;
+    armTimer(timerFd, length);
+
+    bool running = true;
+    while (running) {
+      struct epoll_event events[32];
+      int count = epoll_wait(epollFd, events, 32, -1);
+      if (count == -1) {
+        if (errno == EINTR) {
+          continue;
         }
+        cerr << "epoll_wait failed: " << strerror(errno) << endl;
         break;
       }
-
-      case ABS_Z:
-      case ABS_RZ: {
-        int maxValue = libevdev_get_abs_maximum(evdev.get(), ev.code);
-        /*cout << "trigger input" << endl;*/
-        triggers[ev.code - ABS_Z] =
-            maxValue > 0 ? ev.value / static_cast<float>(maxValue) : 0.0f;
-      } break;
-
-      default:
-        break;
+      for (int i = 0; i < count; i++) {
+        switch (epollSource(events[i].data.u64)) {
+        case EventSource::Timer:
+        case EventSource::Signal:
+          running = false;
+          break;
+        default:
+          registry.handleEpollEvent(events[i].data.u64);
+          break;
+        }
       }
+      registry.reap();
+      flushStatusLog();
     }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return EXIT_FAILURE;
   }
+  close(signalFd);
+  close(timerFd);
+  close(epollFd);
+  diagnostics.write(cout);
+  return 0;
 }
 
-bool Gamepad::isAnyButtonPressed() const {
-  for (bool button : buttons) {
-    if (button) {
-      return true;
-    }
-  }
-  return false;
+// One desktop waypad keeps awake: its Wayland connection, the backend that
+// inhibits idle there and the inhibitor deciding when. Without --seat there
+// is a single, unnamed one for $WAYLAND_DISPLAY that every controller counts
+// for.
+struct Seat {
+  string name;
+  wlContext context;
+  unique_ptr<InhibitBackend> backend;
+  unique_ptr<Inhibitor> inhibitor;
+  int timerFd = -1;
+  chrono::steady_clock::time_point armedDeadline;
+  // No reconnection attempts before this after a failed one.
+  chrono::steady_clock::time_point retryAfter;
+  bool pumpDisplay = false;
+  bool controllersActive = false;
+  // What woke the loop for this seat, reset every iteration.
+  bool inhibitReady = false;
+  bool displayReady = false;
+  bool timerExpired = false;
+  bool inputActive = false;
+  chrono::steady_clock::time_point inputTime;
+};
+
+static const char *seatLabel(const Seat &seat) {
+  return seat.name.empty() ? nullptr : seat.name.c_str();
 }
 
-bool Gamepad::isAxisMoved() const {
-  const float threshold = 0.1f;
-  for (float axis : axes) {
-    if (axis > threshold) {
-      return true;
+static bool openSeat(Seat &seat, InhibitMethod method, bool waitForSeatIdle,
+                     chrono::steady_clock::duration seatIdleTimeout) {
+  seat.backend = openInhibitBackend(method, seat.context);
+  if (!seat.backend ||
+      (waitForSeatIdle && !watchSeat(seat.context, seatIdleTimeout))) {
+    seat.backend.reset();
+    if (seat.context.display) {
+      clean(seat.context);
     }
+    return false;
   }
-  return false;
+  seat.pumpDisplay = ownsDisplay(seat.context, *seat.backend);
+  return true;
 }
 
-bool Gamepad::isAnyTriggerPressed() const {
-  const float threshold = 0.1f;
-  for (float trigger : triggers) {
-    if (trigger > threshold) {
-      return true;
-    }
-  }
-  return false;
+// Every seat's fds carry its index, like the registry's devices.
+static bool registerSeat(int epollFd, Seat &seat, uint32_t index) {
+  return addToEpoll(epollFd, seat.backend->fd(),
+                    epollTag(EventSource::Inhibit, index)) &&
+         (!seat.pumpDisplay ||
+          addToEpoll(epollFd, wl_display_get_fd(seat.context.display),
+                     epollTag(EventSource::Display, index)));
 }
 
-filesystem::path findDevice(const filesystem::path &inputDeviceFolder) {
-  for (const auto &entry : filesystem::directory_iterator(inputDeviceFolder)) {
-    if (filesystem::is_symlink(entry.path())) {
-      filesystem::path canonicalPath = filesystem::canonical(entry.path());
-      if (canonicalPath.string().find("-event-joystick")) {
-        return canonicalPath;
-      }
-    }
+// The desktop went away and took its inhibitor with it. The seat connects
+// again once one of its controllers wants an inhibitor.
+static void closeSeat(int epollFd, Seat &seat) {
+  epoll_ctl(epollFd, EPOLL_CTL_DEL, seat.backend->fd(), nullptr);
+  if (seat.pumpDisplay) {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, wl_display_get_fd(seat.context.display),
+              nullptr);
   }
-  return filesystem::path();
+  seat.inhibitor->dropBackend();
+  seat.backend.reset();
+  if (seat.context.display) {
+    clean(seat.context);
+  }
+  seat.pumpDisplay = false;
+  seat.context.seat_idle_changed = false;
 }
 
-static void registry_handle_global(void *data, struct wl_registry *registry,
-                                   uint32_t name, const char *interface,
-                                   uint32_t version) {
-  wlContext *context = static_cast<wlContext *>(data);
-  if (strcmp(interface, wl_compositor_interface.name) == 0) {
-    context->compositor = static_cast<wl_compositor *>(
-        wl_registry_bind(registry, name, &wl_compositor_interface, version));
-  } else if (strcmp(interface, zwp_idle_inhibit_manager_v1_interface.name) ==
-             0) {
-    context->idle_inhibit_manager =
-        static_cast<zwp_idle_inhibit_manager_v1 *>(wl_registry_bind(
-            registry, name, &zwp_idle_inhibit_manager_v1_interface, version));
+// NAME=DISPLAY, where DISPLAY is a socket name in $XDG_RUNTIME_DIR or an
+// absolute path.
+static bool parseSeat(const char *text, vector<unique_ptr<Seat>> &seats) {
+  const char *separator = strchr(text, '=');
+  if (!separator || separator == text || separator[1] == '\0') {
+    return false;
   }
+  string name(text, separator);
+  for (const unique_ptr<Seat> &seat : seats) {
+    if (seat->name == name) {
+      return false;
+    }
+  }
+  auto seat = make_unique<Seat>();
+  seat->name = name;
+  seat->context.name = separator + 1;
+  seats.push_back(move(seat));
+  return true;
 }
 
-static const struct wl_registry_listener registryListener = {
-    .global = registry_handle_global,
-    .global_remove = [](void *, struct wl_registry *, uint32_t) {}};
-;
-
-bool connectToWayland(wlContext &context) {
-
-  context.display = wl_display_connect(nullptr);
-  if (!context.display) {
-    cerr << "Failed to connect to wayland display " << endl;
+static bool parseInhibitMethod(const char *name, InhibitMethod &method) {
+  if (strcmp(name, "auto") == 0) {
+    method = InhibitMethod::Auto;
+  } else if (strcmp(name, "wayland") == 0) {
+    method = InhibitMethod::Wayland;
+  } else if (strcmp(name, "dbus") == 0) {
+    method = InhibitMethod::DBus;
+  } else {
     return false;
   }
+  return true;
+}
 
-  struct wl_registry *registry = wl_display_get_registry(context.display);
-  if (!registry) {
-    cerr << "Failed to get wayland registry" << endl;
-    wl_display_disconnect(context.display);
+static bool parseBackend(const char *name, InputBackend &backend) {
+  if (strcmp(name, "libevdev") == 0) {
+    backend = InputBackend::Libevdev;
+  } else if (strcmp(name, "raw") == 0) {
+    backend = InputBackend::Raw;
+  } else if (strcmp(name, "io_uring") == 0) {
+    backend = InputBackend::IoUring;
+  } else {
     return false;
   }
+  return true;
+}
 
-  wl_registry_add_listener(registry, &registryListener, &context);
-  wl_display_roundtrip(context.display);
-
-  if (!context.compositor || !context.idle_inhibit_manager) {
-    cerr << "Required Wayland globals not available" << endl;
-    wl_display_disconnect(context.display);
-    return false;
+int main(int argc, char **argv) {
+  string recordPath;
+  string metricsPath;
+  string metricsSocketPath;
+  string snapshotName;
+  vector<string> extraDevices;
+  vector<unique_ptr<Seat>> seats;
+  const RemapProfile *remapProfile = nullptr;
+  double motionRate = 0.0;
+  bool threaded = false;
+  bool realtime = false;
+  bool onDemand = false;
+  chrono::steady_clock::duration exitAfter{};
+  chrono::steady_clock::duration diagnoseFor{};
+  chrono::steady_clock::duration seatIdleTimeout{};
+  InputBackend backend = InputBackend::Libevdev;
+  InhibitMethod inhibitMethod = InhibitMethod::Auto;
+  bool inhibitMethodSet = false;
+  InhibitConfig inhibitConfig;
+  inhibitConfig.idleTimeout = chrono::seconds(THRESHOLD);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (strcmp(argv[i], "--remap") == 0 && i + 1 < argc &&
+               (remapProfile = findRemapProfile(argv[i + 1]))) {
+      i++;
+    } else if (strcmp(argv[i], "--motion-rate") == 0 && i + 1 < argc &&
+               parseRate(argv[i + 1], motionRate)) {
+      i++;
+    } else if (strcmp(argv[i], "--device") == 0 && i + 1 < argc) {
+      // Resolved so a by-id link is not opened a second time by the scan.
+      error_code ec;
+      filesystem::path device = filesystem::canonical(argv[++i], ec);
+      extraDevices.push_back(ec ? argv[i] : device.string());
+    } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+      metricsPath = argv[++i];
+    } else if (strcmp(argv[i], "--metrics-socket") == 0 && i + 1 < argc) {
+      metricsSocketPath = argv[++i];
+    } else if (strcmp(argv[i], "--state-shm") == 0 && i + 1 < argc &&
+               argv[i + 1][0] != '\0') {
+      snapshotName = argv[++i];
+    } else if (strcmp(argv[i], "--input-thread") == 0) {
+      threaded = true;
+    } else if (strcmp(argv[i], "--realtime") == 0) {
+      threaded = true;
+      realtime = true;
+    } else if (strcmp(argv[i], "--backend") == 0 && i + 1 < argc &&
+               parseBackend(argv[i + 1], backend)) {
+      i++;
+    } else if (strcmp(argv[i], "--inhibit") == 0 && i + 1 < argc &&
+               parseInhibitMethod(argv[i + 1], inhibitMethod)) {
+      inhibitMethodSet = true;
+      i++;
+    } else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], inhibitConfig.idleTimeout)) {
+      i++;
+    } else if (strcmp(argv[i], "--activation-delay") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], inhibitConfig.activationDelay)) {
+      i++;
+    } else if (strcmp(argv[i], "--release-grace") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], inhibitConfig.releaseGrace)) {
+      i++;
+    } else if (strcmp(argv[i], "--idle-notify") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], seatIdleTimeout)) {
+      inhibitConfig.waitForSeatIdle = true;
+      i++;
+    } else if (strcmp(argv[i], "--exit-after") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], exitAfter)) {
+      onDemand = true;
+      i++;
+    } else if (strcmp(argv[i], "--seat") == 0 && i + 1 < argc &&
+               seats.size() < MAX_SEATS && parseSeat(argv[i + 1], seats)) {
+      i++;
+    } else if (strcmp(argv[i], "--diagnose") == 0 && i + 1 < argc &&
+               parseSeconds(argv[i + 1], diagnoseFor) &&
+               diagnoseFor > chrono::steady_clock::duration::zero()) {
+      i++;
+    } else {
+      usage(argv[0]);
+      return EXIT_FAILURE;
+    }
   }
 
-  context.surface = wl_compositor_create_surface(context.compositor);
-  if (!context.surface) {
-    cerr << "Failed to create Wayland surface" << endl;
-    wl_display_disconnect(context.display);
-    return false;
+  if (diagnoseFor > chrono::steady_clock::duration::zero()) {
+    return diagnose(diagnoseFor, backend, extraDevices);
   }
-  wl_surface_commit(context.surface);
 
-  return true;
-}
+  // Every seat's session has a compositor of its own but the session bus
+  // belongs to whoever is logged in there, so seats are always inhibited
+  // over Wayland.
+  bool multiSeat = !seats.empty();
+  if (multiSeat) {
+    if (inhibitMethodSet && inhibitMethod != InhibitMethod::Wayland) {
+      cerr << "--seat needs --inhibit wayland" << endl;
+      return EXIT_FAILURE;
+    }
+    inhibitMethod = InhibitMethod::Wayland;
+  } else {
+    seats.push_back(make_unique<Seat>());
+  }
+  // Asking the session bus for the service waits on it, so what Auto means
+  // is settled here, before any input is handled, and reopening the
+  // backend from the loop never has to ask.
+  if (!resolveInhibitMethod(inhibitMethod)) {
+    return EXIT_FAILURE;
+  }
 
-void clean(wlContext &context) {
-  zwp_idle_inhibitor_v1_destroy(context.idle_inhibitor);
-  wl_surface_destroy(context.surface);
-  wl_display_disconnect(context.display);
-}
+  RecordingWriter recorder;
+  if (!recordPath.empty() && !recorder.open(recordPath)) {
+    cerr << "Failed to open recording file: " << recordPath << endl;
+    return EXIT_FAILURE;
+  }
 
-int main() {
-  wlContext context;
-  if (!connectToWayland(context)) {
+  // Started on demand, e.g. by udev when a controller appears, waypad only
+  // talks to the desktop once there is something to inhibit. Seats work
+  // the same way, since their sessions come and go while waypad runs.
+  bool lazy = onDemand || multiSeat;
+  if (!lazy && !openSeat(*seats[0], inhibitMethod,
+                         inhibitConfig.waitForSeatIdle, seatIdleTimeout)) {
     return EXIT_FAILURE;
   }
 
+  int epollFd = -1;
+  int signalFd = -1;
+  int metricsTimerFd = -1;
+  int exitTimerFd = -1;
+  Metrics metrics;
+  Metrics *activeMetrics =
+      metricsPath.empty() && metricsSocketPath.empty() ? nullptr : &metrics;
+  MetricsSocket metricsSocket;
+  StateSnapshot snapshot;
+  StateSnapshot *activeSnapshot = snapshotName.empty() ? nullptr : &snapshot;
+
   try {
-    filesystem::path deviceEventFile = findDevice("/dev/input/by-id/");
-    if (deviceEventFile.empty()) {
-      cout << "Game controller is not connected" << endl;
-      return EXIT_FAILURE;
+    // SIGINT and SIGTERM end the loop so the inhibitor is released and
+    // the counters are reported.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (epollFd == -1 || signalFd == -1) {
+      throw runtime_error("Failed to create event loop: " +
+                          string(strerror(errno)));
+    }
+    for (size_t i = 0; i < seats.size(); i++) {
+      Seat &seat = *seats[i];
+      seat.timerFd =
+          timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (seat.timerFd == -1) {
+        throw runtime_error("Failed to create event loop: " +
+                            string(strerror(errno)));
+      }
+      if ((seat.backend && !registerSeat(epollFd, seat, i)) ||
+          !addToEpoll(epollFd, seat.timerFd,
+                      epollTag(EventSource::Timer, i))) {
+        throw runtime_error("Failed to register fd with epoll: " +
+                            string(strerror(errno)));
+      }
+    }
+    if (!addToEpoll(epollFd, signalFd, epollTag(EventSource::Signal))) {
+      throw runtime_error("Failed to register fd with epoll: " +
+                          string(strerror(errno)));
+    }
+    if (!metricsPath.empty()) {
+      metricsTimerFd =
+          timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (metricsTimerFd == -1 ||
+          !armInterval(metricsTimerFd, chrono::seconds(METRICS_INTERVAL)) ||
+          !addToEpoll(epollFd, metricsTimerFd,
+                      epollTag(EventSource::MetricsTimer))) {
+        throw runtime_error("Failed to schedule metrics export: " +
+                            string(strerror(errno)));
+      }
+    }
+    if (onDemand) {
+      exitTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+      if (exitTimerFd == -1 ||
+          !addToEpoll(epollFd, exitTimerFd, epollTag(EventSource::ExitTimer))) {
+        throw runtime_error("Failed to create exit timer: " +
+                            string(strerror(errno)));
+      }
+    }
+    if (!metricsSocketPath.empty() &&
+        (!metricsSocket.open(metricsSocketPath) ||
+         !addToEpoll(epollFd, metricsSocket.fd(),
+                     epollTag(EventSource::MetricsSocket)))) {
+      throw runtime_error("Failed to open metrics socket " +
+                          metricsSocketPath + ": " + string(strerror(errno)));
     }
 
-    Gamepad gamepad(deviceEventFile);
-
-    bool isActive = false;
-    bool firstIter = true;
+    if (activeSnapshot && !snapshot.open(snapshotName)) {
+      throw runtime_error("Failed to create shared state " + snapshotName +
+                          ": " + string(strerror(errno)));
+    }
 
-    auto lastActiveTime = chrono::steady_clock::now();
+    vector<string> seatNames;
+    if (multiSeat) {
+      for (const unique_ptr<Seat> &seat : seats) {
+        seatNames.push_back(seat->name);
+      }
+    }
+    RecordingWriter *activeRecorder = recordPath.empty() ? nullptr : &recorder;
+    unique_ptr<RemapTable> remapTable;
+    if (remapProfile) {
+      remapTable = make_unique<RemapTable>(*remapProfile);
+    }
+    unique_ptr<DeviceRegistry> registry;
+    unique_ptr<InputThread> inputThread;
+    size_t deviceCount = 0;
+    if (threaded) {
+      inputThread = make_unique<InputThread>();
+      inputThread->setMetrics(activeMetrics);
+      inputThread->setSnapshot(activeSnapshot);
+      inputThread->setSeats(seatNames);
+      if (remapTable && !inputThread->setRemap(remapTable.get())) {
+        throw runtime_error("Failed to set up remapping: " +
+                            string(strerror(errno)));
+      }
+      if (!inputThread->setMotionRate(motionRate)) {
+        throw runtime_error("Failed to set up motion sampling: " +
+                            string(strerror(errno)));
+      }
+      for (const string &path : extraDevices) {
+        inputThread->addDevice(path);
+      }
+      if (!addToEpoll(epollFd, inputThread->notifyFd(),
+                      epollTag(EventSource::Input))) {
+        throw runtime_error("Failed to register fd with epoll: " +
+                            string(strerror(errno)));
+      }
+      deviceCount =
+          inputThread->start("/dev/input", activeRecorder, backend, realtime);
+    } else {
+      registry = make_unique<DeviceRegistry>(epollFd);
+      registry->setRecorder(activeRecorder);
+      registry->setMetrics(activeMetrics);
+      registry->setSnapshot(activeSnapshot);
+      registry->setSeats(seatNames);
+      if (remapTable && !registry->setRemap(remapTable.get())) {
+        throw runtime_error("Failed to set up remapping: " +
+                            string(strerror(errno)));
+      }
+      if (!registry->setMotionRate(motionRate)) {
+        throw runtime_error("Failed to set up motion sampling: " +
+                            string(strerror(errno)));
+      }
+      registry->setBackend(backend);
+      if (!registry->watch("/dev/input")) {
+        cerr << "Failed to watch for controller hotplug: " << strerror(errno)
+             << endl;
+        registry->scan("/dev/input");
+      }
+      for (const string &path : extraDevices) {
+        if (!registry->contains(path)) {
+          registry->add(path);
+        }
+      }
+      deviceCount = registry->size();
+    }
+    flushStatusLog();
+    if (deviceCount == 0 && !lazy) {
+      cout << "Game controller is not connected" << endl;
+      return EXIT_FAILURE;
+    }
+    bool deviceless = deviceCount == 0;
+    if (deviceless && onDemand) {
+      armTimer(exitTimerFd, exitAfter);
+    }
 
-    while (true) {
-      while (wl_display_prepare_read(context.display) != 0) {
-        wl_display_dispatch_pending(context.display);
+    auto startTime = chrono::steady_clock::now();
+    for (unique_ptr<Seat> &seat : seats) {
+      InhibitConfig config = inhibitConfig;
+      config.seat = seatLabel(*seat);
+      seat->inhibitor =
+          make_unique<Inhibitor>(seat->backend.get(), config, startTime);
+      if (activeMetrics) {
+        seat->inhibitor->setMetrics(multiSeat ? metrics.addSeat(seat->name)
+                                              : &metrics.inhibitor);
       }
-      wl_display_flush(context.display);
+      seat->armedDeadline = seat->inhibitor->deadline();
+      armTimer(seat->timerFd, seat->armedDeadline - startTime);
+    }
 
-      if (wl_display_read_events(context.display) == -1) {
-        cerr << "Failed to read Wayland events" << endl;
+    // Without --seat, losing the desktop ends waypad as it always has;
+    // a seat's session may simply have ended. A broken display connection
+    // has already been reported by the Wayland helpers.
+    auto lost = [&](Seat &seat, bool inhibitBackend) {
+      if (inhibitBackend) {
+        cerr << "Lost the connection to the " << seat.backend->name()
+             << " inhibit backend";
+        if (!seat.name.empty()) {
+          cerr << " of " << seat.name;
+        }
+        cerr << endl;
+      }
+      if (!multiSeat) {
+        return false;
+      }
+      closeSeat(epollFd, seat);
+      return true;
+    };
+
+    bool running = true;
+    while (running) {
+      for (unique_ptr<Seat> &entry : seats) {
+        Seat &seat = *entry;
+        if (seat.backend && !seat.backend->prepare() &&
+            !lost(seat, true)) {
+          running = false;
+          break;
+        }
+        if (seat.pumpDisplay && !prepareWaylandRead(seat.context) &&
+            !lost(seat, false)) {
+          running = false;
+          break;
+        }
+      }
+      if (!running) {
         break;
       }
+      flushStatusLog();
+
+      struct epoll_event events[32];
+      int count = epoll_wait(epollFd, events, 32, -1);
+      if (count == -1) {
+        for (unique_ptr<Seat> &seat : seats) {
+          if (seat->backend) {
+            seat->backend->dispatch(false);
+          }
+          if (seat->pumpDisplay) {
+            wl_display_cancel_read(seat->context.display);
+          }
+        }
+        if (errno == EINTR) {
+          continue;
+        }
+        cerr << "epoll_wait failed: " << strerror(errno) << endl;
+        break;
+      }
+      if (activeMetrics) {
+        metrics.mainWakeups.add();
+      }
 
-      wl_display_dispatch_pending(context.display);
-
-      auto currentTime = chrono::steady_clock::now();
-      gamepad.updateState();
-
-      bool anyButtonPress = gamepad.isAnyButtonPressed();
-      bool axisMove = gamepad.isAxisMoved();
-      bool triggerPress = gamepad.isAnyTriggerPressed();
-
-      if (anyButtonPress || axisMove || triggerPress) {
-        if (!isActive) {
-          cout << "controller is active" << endl;
-          isActive = true;
-          firstIter = false;
-
-          if (!context.idle_inhibitor) {
-            context.idle_inhibitor =
-                zwp_idle_inhibit_manager_v1_create_inhibitor(
-                    context.idle_inhibit_manager, context.surface);
-            wl_surface_commit(context.surface);
-            cout << "Idle inhibitor created successfully" << endl;
+      for (unique_ptr<Seat> &seat : seats) {
+        seat->inhibitReady = false;
+        seat->displayReady = false;
+        seat->timerExpired = false;
+        seat->inputActive = false;
+        seat->inputTime = chrono::steady_clock::time_point::max();
+      }
+      for (int i = 0; i < count; i++) {
+        uint64_t tag = events[i].data.u64;
+        switch (epollSource(tag)) {
+        case EventSource::Inhibit:
+          seats[epollIndex(tag)]->inhibitReady = true;
+          break;
+        case EventSource::Display:
+          seats[epollIndex(tag)]->displayReady = true;
+          break;
+        case EventSource::Timer: {
+          Seat &seat = *seats[epollIndex(tag)];
+          uint64_t expirations;
+          seat.timerExpired = read(seat.timerFd, &expirations,
+                                   sizeof(expirations)) == sizeof(expirations);
+          break;
+        }
+        case EventSource::Signal:
+          running = false;
+          break;
+        case EventSource::ExitTimer: {
+          uint64_t expirations;
+          if (read(exitTimerFd, &expirations, sizeof(expirations)) ==
+                  sizeof(expirations) &&
+              deviceless) {
+            logStatus("No game controller left, exiting");
+            running = false;
+          }
+          break;
+        }
+        case EventSource::MetricsTimer: {
+          uint64_t expirations;
+          if (read(metricsTimerFd, &expirations, sizeof(expirations)) ==
+                  sizeof(expirations) &&
+              !metrics.writeFile(metricsPath)) {
+            cerr << "Failed to write metrics to " << metricsPath << endl;
+          }
+          break;
+        }
+        case EventSource::MetricsSocket:
+          metricsSocket.serve(metrics);
+          break;
+        case EventSource::Input: {
+          uint64_t notifications;
+          if (read(inputThread->notifyFd(), &notifications,
+                   sizeof(notifications)) == -1 &&
+              errno != EAGAIN) {
+            cerr << "Failed to read input notification: " << strerror(errno)
+                 << endl;
+          }
+          ActivityEdge edge;
+          while (inputThread->pop(edge)) {
+            Seat &seat = *seats[edge.seat];
+            if (edge.active) {
+              seat.inputActive = true;
+              seat.inputTime = min(seat.inputTime, edge.time);
+            }
+            seat.controllersActive = edge.active;
           }
+          break;
+        }
+        default:
+          registry->handleEpollEvent(tag);
+          break;
+        }
+      }
+      if (registry) {
+        registry->reap();
+        for (size_t i = 0; i < seats.size(); i++) {
+          Seat &seat = *seats[i];
+          auto activityTime = registry->takeActivityTime(i);
+          if (activityTime != chrono::steady_clock::time_point::max()) {
+            seat.inputActive = true;
+            seat.inputTime = activityTime;
+          }
+          seat.controllersActive = registry->isActive(i);
+        }
+        if (activeRecorder) {
+          recorder.flush();
         }
-        lastActiveTime = currentTime;
       }
+      if (onDemand) {
+        size_t devices =
+            registry ? registry->size() : inputThread->deviceCount();
+        if ((devices == 0) != deviceless) {
+          deviceless = devices == 0;
+          if (deviceless) {
+            armTimer(exitTimerFd, exitAfter);
+          } else {
+            disarmTimer(exitTimerFd);
+          }
+        }
+      }
+
+      auto currentTime = chrono::steady_clock::now();
+      bool anyInhibiting = false;
+      for (size_t i = 0; i < seats.size(); i++) {
+        Seat &seat = *seats[i];
+        if (seat.backend && !seat.backend->dispatch(seat.inhibitReady) &&
+            !lost(seat, true)) {
+          running = false;
+          break;
+        }
+        if (seat.pumpDisplay &&
+            !dispatchWayland(seat.context, seat.displayReady) &&
+            !lost(seat, false)) {
+          running = false;
+          break;
+        }
+        bool seatChanged = seat.context.seat_idle_changed;
+        if (seatChanged) {
+          seat.context.seat_idle_changed = false;
+          logStatus(seat.context.seat_idle ? "seat is idle" : "seat is in use",
+                    seatLabel(seat));
+          seat.inhibitor->setSeatIdle(seat.context.seat_idle);
+        }
+
+        // A held control produces no events, so it counts as fresh input
+        // whenever the timer asks for a re-evaluation.
+        if (seat.timerExpired && seat.controllersActive) {
+          seat.inputActive = true;
+        }
+        Inhibitor &inhibitor = *seat.inhibitor;
+        if (!seat.inputActive && !seat.timerExpired && !seatChanged) {
+          anyInhibiting |= inhibitor.isInhibiting();
+          continue;
+        }
 
-      auto inactiveDuration =
-          chrono::duration_cast<chrono::seconds>(currentTime - lastActiveTime);
-
-      if (inactiveDuration.count() >= THRESHOLD) {
-        if (isActive) {
-          cout << "controller is inactive" << endl;
-          isActive = false;
-          if (context.idle_inhibitor) {
-            zwp_idle_inhibitor_v1_destroy(context.idle_inhibitor);
-            wl_surface_commit(context.surface);
-            context.idle_inhibitor = 0;
-            cout << "Idle inhibitor destroyed successfully" << endl;
+        if (seat.inputActive) {
+          inhibitor.onActivity(currentTime,
+                               min(seat.inputTime, currentTime));
+        } else {
+          inhibitor.update(currentTime);
+        }
+        if (!seat.backend && inhibitor.wantsInhibitor() &&
+            currentTime >= seat.retryAfter) {
+          if (!openSeat(seat, inhibitMethod, inhibitConfig.waitForSeatIdle,
+                        seatIdleTimeout)) {
+            if (!multiSeat) {
+              throw runtime_error("No inhibit backend available");
+            }
+            seat.retryAfter = currentTime + chrono::seconds(RECONNECT_DELAY);
+          } else if (!registerSeat(epollFd, seat, i)) {
+            throw runtime_error("Failed to register fd with epoll: " +
+                                string(strerror(errno)));
+          } else {
+            inhibitor.setBackend(seat.backend.get());
           }
-        } else if (firstIter) {
-          cout << "controller is inactive" << endl;
-          firstIter = false;
         }
+        inhibitor.flush();
+        anyInhibiting |= inhibitor.isInhibiting();
+
+        // Input only ever pushes the deadline later, so the timer is left
+        // alone then and simply re-armed once it fires early.
+        auto deadline = inhibitor.deadline();
+        if (seat.timerExpired || deadline < seat.armedDeadline) {
+          seat.armedDeadline = deadline;
+          if (deadline != chrono::steady_clock::time_point::max()) {
+            armTimer(seat.timerFd, deadline - currentTime);
+          }
+        }
+      }
+      // On every wakeup rather than only after an evaluation, since closing
+      // a seat or dropping its backend clears its inhibitor without one.
+      // Nothing is written unless the state changed.
+      if (activeSnapshot) {
+        snapshot.publishInhibitor(anyInhibiting, currentTime);
       }
+    }
 
-      this_thread::sleep_for(chrono::milliseconds(10));
+    flushStatusLog();
+    for (const unique_ptr<Seat> &seat : seats) {
+      const InhibitStats &stats = seat->inhibitor->stats();
+      if (!seat->name.empty()) {
+        cout << seat->name << ": ";
+      }
+      cout << "Inhibitor requests sent: " << stats.requestsSent
+           << ", avoided: " << stats.requestsAvoided
+           << ", inhibitors created: " << stats.inhibits << endl;
+    }
+    if (!metricsPath.empty() && !metrics.writeFile(metricsPath)) {
+      cerr << "Failed to write metrics to " << metricsPath << endl;
     }
   } catch (const exception &e) {
     cerr << "Error: " << e.what() << endl;
     return EXIT_FAILURE;
   }
 
-  clean(context);
+  if (metricsTimerFd != -1) {
+    close(metricsTimerFd);
+  }
+  if (exitTimerFd != -1) {
+    close(exitTimerFd);
+  }
+  close(signalFd);
+  for (unique_ptr<Seat> &seat : seats) {
+    close(seat->timerFd);
+    seat->backend.reset();
+    if (seat->context.display) {
+      clean(seat->context);
+    }
+  }
+  close(epollFd);
 
   return 0;
 }
@@ -0,0 +1,164 @@
+#include "controller_profile.h"
+#include <cstddef>
+
+using namespace std;
+
+enum class ControllerFamily { Generic, Xbox, PlayStation, SwitchPro };
+
+// Every layout decodes the whole BTN_A..BTN_THUMBR block, since drivers
+// only ever send a subset of it. A layout describes the rest: where each
+// GamepadState axis comes from, which keys carry the D-pad (one or more
+// sets of up, down, left, right; 0 where there are none), whether it has a
+// hat, and whether touchpad contacts count as input.
+template <ControllerFamily> struct Layout;
+
+// Third-party pads xpad drives fall through to here when their vendor is
+// not Microsoft's, so the trigger-happy D-pad of dpad_to_buttons is
+// decoded as well; nothing else sends those codes.
+template <> struct Layout<ControllerFamily::Generic> {
+  static constexpr const char *name = "generic";
+  static constexpr uint16_t axes[AXIS_COUNT] = {ABS_X,  ABS_Y,  ABS_Z,
+                                                ABS_RX, ABS_RY, ABS_RZ};
+  static constexpr uint16_t dpadKeys[2][4] = {
+      {BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT},
+      {BTN_TRIGGER_HAPPY3, BTN_TRIGGER_HAPPY4, BTN_TRIGGER_HAPPY1,
+       BTN_TRIGGER_HAPPY2}};
+  static constexpr bool hat = true;
+  static constexpr bool touchpad = true;
+};
+
+// xpad and xone. Pads xpad drives with dpad_to_buttons report the D-pad
+// as trigger-happy keys instead of the hat.
+template <> struct Layout<ControllerFamily::Xbox> {
+  static constexpr const char *name = "xbox";
+  static constexpr uint16_t axes[AXIS_COUNT] = {ABS_X,  ABS_Y,  ABS_Z,
+                                                ABS_RX, ABS_RY, ABS_RZ};
+  static constexpr uint16_t dpadKeys[1][4] = {
+      {BTN_TRIGGER_HAPPY3, BTN_TRIGGER_HAPPY4, BTN_TRIGGER_HAPPY1,
+       BTN_TRIGGER_HAPPY2}};
+  static constexpr bool hat = true;
+  static constexpr bool touchpad = false;
+};
+
+// hid-playstation. The touchpad is its own node with the same ids.
+template <> struct Layout<ControllerFamily::PlayStation> {
+  static constexpr const char *name = "playstation";
+  static constexpr uint16_t axes[AXIS_COUNT] = {ABS_X,  ABS_Y,  ABS_Z,
+                                                ABS_RX, ABS_RY, ABS_RZ};
+  static constexpr uint16_t dpadKeys[1][4] = {{0, 0, 0, 0}};
+  static constexpr bool hat = true;
+  static constexpr bool touchpad = true;
+};
+
+// hid-nintendo. ZL and ZR are digital (BTN_TL2/BTN_TR2), so there are no
+// trigger axes.
+template <> struct Layout<ControllerFamily::SwitchPro> {
+  static constexpr const char *name = "switch-pro";
+  static constexpr uint16_t axes[AXIS_COUNT] = {ABS_X,  ABS_Y,  NO_AXIS,
+                                                ABS_RX, ABS_RY, NO_AXIS};
+  static constexpr uint16_t dpadKeys[1][4] = {
+      {BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT}};
+  static constexpr bool hat = false;
+  static constexpr bool touchpad = false;
+};
+
+static constexpr void setKey(ControllerProfile &profile, uint16_t code,
+                             DecodeKind kind, unsigned int index) {
+  profile.keys[code - KEY_TABLE_FIRST] = {kind, static_cast<uint8_t>(index)};
+}
+
+template <ControllerFamily family> constexpr ControllerProfile buildProfile() {
+  using L = Layout<family>;
+  ControllerProfile profile;
+  profile.name = L::name;
+  for (unsigned int code = BTN_A; code <= BTN_THUMBR; code++) {
+    setKey(profile, code, DecodeKind::Button, code - BTN_A);
+  }
+  for (const auto &keys : L::dpadKeys) {
+    for (unsigned int i = 0; i < 4; i++) {
+      if (keys[i] != 0) {
+        setKey(profile, keys[i], DecodeKind::Button, DPAD_BIT + i);
+      }
+    }
+  }
+  for (unsigned int slot = 0; slot < AXIS_COUNT; slot++) {
+    profile.axisCodes[slot] = L::axes[slot];
+    if (L::axes[slot] != NO_AXIS) {
+      profile.abs[L::axes[slot]] = {DecodeKind::Axis,
+                                    static_cast<uint8_t>(slot)};
+    }
+  }
+  if (L::hat) {
+    profile.abs[ABS_HAT0Y] = {DecodeKind::Hat, DPAD_BIT};
+    profile.abs[ABS_HAT0X] = {DecodeKind::Hat, DPAD_BIT + 2};
+  }
+  if (L::touchpad) {
+    setKey(profile, BTN_TOUCH, DecodeKind::Touch, 0);
+    for (unsigned int code = ABS_MT_SLOT; code < ABS_CNT; code++) {
+      profile.abs[code] = {DecodeKind::Contact, 0};
+    }
+  }
+  return profile;
+}
+
+// A layout whose codes fall outside the tables fails to compile here
+// rather than decoding garbage.
+template <ControllerFamily family> constexpr bool fitsTables() {
+  using L = Layout<family>;
+  for (const auto &keys : L::dpadKeys) {
+    for (uint16_t code : keys) {
+      if (code != 0 && (code < KEY_TABLE_FIRST ||
+                        code - KEY_TABLE_FIRST >= KEY_TABLE_SIZE)) {
+        return false;
+      }
+    }
+  }
+  for (uint16_t code : L::axes) {
+    if (code != NO_AXIS && code >= ABS_MT_SLOT) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(fitsTables<ControllerFamily::Generic>() &&
+                  fitsTables<ControllerFamily::Xbox>() &&
+                  fitsTables<ControllerFamily::PlayStation>() &&
+                  fitsTables<ControllerFamily::SwitchPro>(),
+              "layout codes must fit the decode tables");
+
+extern constexpr ControllerProfile genericControllerProfile =
+    buildProfile<ControllerFamily::Generic>();
+static constexpr ControllerProfile xboxProfile =
+    buildProfile<ControllerFamily::Xbox>();
+static constexpr ControllerProfile playStationProfile =
+    buildProfile<ControllerFamily::PlayStation>();
+static constexpr ControllerProfile switchProProfile =
+    buildProfile<ControllerFamily::SwitchPro>();
+
+struct ProfileMatch {
+  uint16_t vendor;
+  // 0 matches every product of the vendor.
+  uint16_t product;
+  const ControllerProfile *profile;
+};
+
+static const ProfileMatch profileMatches[] = {
+    {0x045e, 0, &xboxProfile},
+    {0x054c, 0x05c4, &playStationProfile}, // DualShock 4
+    {0x054c, 0x09cc, &playStationProfile}, // DualShock 4 v2
+    {0x054c, 0x0ce6, &playStationProfile}, // DualSense
+    {0x054c, 0x0df2, &playStationProfile}, // DualSense Edge
+    {0x057e, 0x2009, &switchProProfile},   // Switch Pro Controller
+};
+
+const ControllerProfile &findControllerProfile(uint16_t vendor,
+                                               uint16_t product) {
+  for (const ProfileMatch &match : profileMatches) {
+    if (match.vendor == vendor &&
+        (match.product == 0 || match.product == product)) {
+      return *match.profile;
+    }
+  }
+  return genericControllerProfile;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <linux/input.h>
+
+#define AXIS_COUNT (ABS_RZ - ABS_X + 1)
+
+// The D-pad shares the button mask, after BTN_A..BTN_THUMBR, in the order
+// up, down, left, right. Drivers report it as BTN_DPAD_* keys, as the
+// ABS_HAT0X/ABS_HAT0Y hat, or (xpad on some pads) as BTN_TRIGGER_HAPPY1..4.
+#define DPAD_BIT (BTN_THUMBR - BTN_A + 1)
+
+// Key codes a profile can decode: the gamepad block with BTN_TOUCH and the
+// D-pad keys in between, up to the trigger-happy keys xpad uses for the
+// D-pad.
+#define KEY_TABLE_FIRST BTN_MISC
+#define KEY_TABLE_SIZE (BTN_TRIGGER_HAPPY4 - BTN_MISC + 1)
+
+// Marks a GamepadState axis the controller does not have.
+#define NO_AXIS 0xffff
+
+// What an event code feeds. Button sets bit index of the mask, Axis writes
+// axis slot index, Hat sets the D-pad bit pair starting at index, Touch
+// counts as momentary input while the value is non-zero and Contact on
+// every event.
+enum class DecodeKind : uint8_t { None, Button, Axis, Hat, Touch, Contact };
+
+struct DecodeSlot {
+  DecodeKind kind = DecodeKind::None;
+  uint8_t index = 0;
+};
+
+// A dense code -> slot table for one controller family, built at compile
+// time, so decoding an event is a single lookup whatever layout the
+// driver uses. axisCodes is the reverse mapping, used to read ranges and
+// resync state.
+struct ControllerProfile {
+  const char *name = nullptr;
+  DecodeSlot keys[KEY_TABLE_SIZE];
+  DecodeSlot abs[ABS_CNT];
+  uint16_t axisCodes[AXIS_COUNT] = {};
+
+  DecodeSlot decode(uint16_t type, uint16_t code) const {
+    if (type == EV_ABS) {
+      return code < ABS_CNT ? abs[code] : DecodeSlot();
+    }
+    unsigned int index = code - KEY_TABLE_FIRST;
+    return type == EV_KEY && index < KEY_TABLE_SIZE ? keys[index]
+                                                    : DecodeSlot();
+  }
+};
+
+extern const ControllerProfile genericControllerProfile;
+
+// Picks the profile for a device by its USB/Bluetooth ids. Anything not
+// known gets the generic profile, which accepts every layout.
+const ControllerProfile &findControllerProfile(uint16_t vendor,
+                                               uint16_t product);
@@ -0,0 +1,316 @@
+#include "inhibit_backend.h"
+
+#ifdef WAYPAD_HAVE_DBUS
+
+#include "status_log.h"
+#include <chrono>
+#include <cstdlib>
+#include <dbus/dbus.h>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+#define SCREENSAVER_SERVICE "org.freedesktop.ScreenSaver"
+#define SCREENSAVER_PATH "/org/freedesktop/ScreenSaver"
+#define SCREENSAVER_INTERFACE "org.freedesktop.ScreenSaver"
+// How long a blocking wait gives the bus or the service to answer, so a
+// wedged bus daemon or a service that took the name and never replies
+// cannot hang startup or shutdown.
+#define DBUS_REPLY_TIMEOUT_MS 3000
+
+// Where libdbus itself looks without DBUS_SESSION_BUS_ADDRESS, short of
+// autolaunching a bus through X11.
+static string sessionBusAddress() {
+  if (const char *address = getenv("DBUS_SESSION_BUS_ADDRESS")) {
+    return address;
+  }
+  const char *runtimeDir = getenv("XDG_RUNTIME_DIR");
+  if (!runtimeDir) {
+    return "";
+  }
+  string path = string(runtimeDir) + "/bus";
+  if (access(path.c_str(), F_OK) != 0) {
+    return "";
+  }
+  char *escaped = dbus_address_escape_value(path.c_str());
+  if (!escaped) {
+    return "";
+  }
+  string address = string("unix:path=") + escaped;
+  dbus_free(escaped);
+  return address;
+}
+
+static void ownerReplied(DBusPendingCall *pending, void *data) {
+  DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+  dbus_bool_t hasOwner = FALSE;
+  bool ok = reply && dbus_message_get_type(reply) ==
+                         DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+            dbus_message_get_args(reply, nullptr, DBUS_TYPE_BOOLEAN,
+                                  &hasOwner, DBUS_TYPE_INVALID);
+  if (reply) {
+    dbus_message_unref(reply);
+  }
+  static_cast<DBusInhibitBackend *>(data)->onOwnerReply(ok, hasOwner);
+}
+
+// On-demand mode opens the backend from the event loop, so nothing here
+// waits for the bus. Opening a private connection only connects the
+// socket; authentication, Hello and the NameHasOwner check go out from
+// prepare() and their replies come back through dispatch(). Hello's reply
+// only names the connection, which nothing here needs, so it is left to
+// be dropped.
+unique_ptr<DBusInhibitBackend> DBusInhibitBackend::create() {
+  string address = sessionBusAddress();
+  if (address.empty()) {
+    return nullptr;
+  }
+  DBusError error;
+  dbus_error_init(&error);
+  DBusConnection *connection =
+      dbus_connection_open_private(address.c_str(), &error);
+  if (!connection) {
+    dbus_error_free(&error);
+    return nullptr;
+  }
+  dbus_connection_set_exit_on_disconnect(connection, FALSE);
+  unique_ptr<DBusInhibitBackend> backend(new DBusInhibitBackend(connection));
+
+  DBusMessage *hello = dbus_message_new_method_call(
+      DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "Hello");
+  DBusMessage *query = dbus_message_new_method_call(
+      DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS, "NameHasOwner");
+  const char *service = SCREENSAVER_SERVICE;
+  bool ok = hello && query &&
+            dbus_message_append_args(query, DBUS_TYPE_STRING, &service,
+                                     DBUS_TYPE_INVALID) &&
+            dbus_connection_send(connection, hello, nullptr) &&
+            dbus_connection_send_with_reply(connection, query,
+                                            &backend->ownerCall,
+                                            DBUS_REPLY_TIMEOUT_MS) &&
+            backend->ownerCall &&
+            dbus_connection_get_unix_fd(connection, &backend->busFd);
+  if (hello) {
+    dbus_message_unref(hello);
+  }
+  if (query) {
+    dbus_message_unref(query);
+  }
+  if (!ok) {
+    return nullptr;
+  }
+  dbus_pending_call_set_notify(backend->ownerCall, ownerReplied,
+                               backend.get(), nullptr);
+  return backend;
+}
+
+DBusInhibitBackend::DBusInhibitBackend(DBusConnection *connection)
+    : connection(connection) {}
+
+// Services drop the inhibitions of a client that disconnects, but not all
+// of them do, so an active one is released explicitly. That includes an
+// Inhibit still waiting for its cookie, which is given up to
+// DBUS_REPLY_TIMEOUT_MS to arrive, since there is nothing to release
+// without it; past that the call is cancelled and closing the connection
+// is left to drop the inhibition. Any call left pending is cancelled so
+// its notify never reaches this backend.
+DBusInhibitBackend::~DBusInhibitBackend() {
+  bool release = haveCookie || inhibitCall;
+  if (inhibitCall) {
+    releaseWanted = true;
+    auto deadline = chrono::steady_clock::now() +
+                    chrono::milliseconds(DBUS_REPLY_TIMEOUT_MS);
+    while (inhibitCall) {
+      auto remaining = chrono::duration_cast<chrono::milliseconds>(
+          deadline - chrono::steady_clock::now());
+      if (remaining.count() <= 0 ||
+          !dbus_connection_read_write_dispatch(
+              connection, static_cast<int>(remaining.count()))) {
+        break;
+      }
+    }
+  }
+  if (haveCookie) {
+    sendUnInhibit();
+  }
+  for (DBusPendingCall *pending : {ownerCall, inhibitCall}) {
+    if (pending) {
+      dbus_pending_call_cancel(pending);
+      dbus_pending_call_unref(pending);
+    }
+  }
+  if (release) {
+    dbus_connection_flush(connection);
+  }
+  dbus_connection_close(connection);
+  dbus_connection_unref(connection);
+}
+
+// Only for resolveInhibitMethod(), before the event loop runs. libdbus
+// enforces the reply timeout in a blocking wait, so this gives up after
+// DBUS_REPLY_TIMEOUT_MS and reports the service as missing.
+bool DBusInhibitBackend::waitForService() {
+  if (ownerCall) {
+    dbus_pending_call_block(ownerCall);
+  }
+  return serviceKnown && !serviceMissing;
+}
+
+void DBusInhibitBackend::onOwnerReply(bool ok, bool hasOwner) {
+  dbus_pending_call_unref(ownerCall);
+  ownerCall = nullptr;
+  serviceKnown = true;
+  serviceMissing = !ok || !hasOwner;
+  if (!serviceMissing && inhibitHeld) {
+    inhibitHeld = false;
+    sendInhibit();
+  }
+}
+
+static void inhibitReplied(DBusPendingCall *pending, void *data) {
+  DBusMessage *reply = dbus_pending_call_steal_reply(pending);
+  uint32_t cookie = 0;
+  bool ok = reply && dbus_message_get_type(reply) ==
+                         DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+            dbus_message_get_args(reply, nullptr, DBUS_TYPE_UINT32, &cookie,
+                                  DBUS_TYPE_INVALID);
+  if (reply) {
+    dbus_message_unref(reply);
+  }
+  static_cast<DBusInhibitBackend *>(data)->onInhibitReply(ok, cookie);
+}
+
+void DBusInhibitBackend::inhibit() {
+  if (!serviceKnown) {
+    inhibitHeld = true;
+  } else if (inhibitCall) {
+    // The Inhibit still in flight stands; forget the release queued
+    // behind it.
+    releaseWanted = false;
+  } else {
+    sendInhibit();
+  }
+}
+
+void DBusInhibitBackend::uninhibit() {
+  if (!serviceKnown) {
+    inhibitHeld = false;
+  } else if (inhibitCall) {
+    releaseWanted = true;
+  } else if (haveCookie) {
+    sendUnInhibit();
+  }
+}
+
+// libdbus only enforces the reply timeout in a blocking wait, which the
+// event loop never does, so there a late cookie is still handled; it
+// bounds the wait at exit.
+void DBusInhibitBackend::sendInhibit() {
+  DBusMessage *message =
+      dbus_message_new_method_call(SCREENSAVER_SERVICE, SCREENSAVER_PATH,
+                                   SCREENSAVER_INTERFACE, "Inhibit");
+  const char *application = "waypad";
+  const char *reason = "Game controller in use";
+  if (!message ||
+      !dbus_message_append_args(message, DBUS_TYPE_STRING, &application,
+                                DBUS_TYPE_STRING, &reason,
+                                DBUS_TYPE_INVALID) ||
+      !dbus_connection_send_with_reply(connection, message, &inhibitCall,
+                                       DBUS_REPLY_TIMEOUT_MS) ||
+      !inhibitCall) {
+    logStatus("Failed to send ScreenSaver.Inhibit");
+  } else {
+    dbus_pending_call_set_notify(inhibitCall, inhibitReplied, this, nullptr);
+  }
+  if (message) {
+    dbus_message_unref(message);
+  }
+}
+
+void DBusInhibitBackend::onInhibitReply(bool ok, uint32_t cookie) {
+  dbus_pending_call_unref(inhibitCall);
+  inhibitCall = nullptr;
+  if (!ok) {
+    logStatus("ScreenSaver.Inhibit failed");
+    releaseWanted = false;
+    return;
+  }
+  this->cookie = cookie;
+  haveCookie = true;
+  if (releaseWanted) {
+    releaseWanted = false;
+    sendUnInhibit();
+  }
+}
+
+void DBusInhibitBackend::sendUnInhibit() {
+  haveCookie = false;
+  DBusMessage *message =
+      dbus_message_new_method_call(SCREENSAVER_SERVICE, SCREENSAVER_PATH,
+                                   SCREENSAVER_INTERFACE, "UnInhibit");
+  if (!message) {
+    logStatus("Failed to send ScreenSaver.UnInhibit");
+    return;
+  }
+  dbus_message_set_no_reply(message, TRUE);
+  if (!dbus_message_append_args(message, DBUS_TYPE_UINT32, &cookie,
+                                DBUS_TYPE_INVALID) ||
+      !dbus_connection_send(connection, message, nullptr)) {
+    logStatus("Failed to send ScreenSaver.UnInhibit");
+  }
+  dbus_message_unref(message);
+}
+
+// The bus socket is non-blocking, so a zero timeout writes what the kernel
+// takes and returns. Calls are a few hundred bytes; the rest would go out
+// on the next wakeup.
+bool DBusInhibitBackend::prepare() {
+  if (dbus_connection_has_messages_to_send(connection) &&
+      !dbus_connection_read_write(connection, 0)) {
+    return false;
+  }
+  // Writing may have read a reply too, which epoll will not report again.
+  while (dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS) {
+  }
+  if (dbus_connection_has_messages_to_send(connection)) {
+    dbus_connection_read_write(connection, 0);
+  }
+  return !serviceMissing && dbus_connection_get_is_connected(connection);
+}
+
+bool DBusInhibitBackend::dispatch(bool readable) {
+  if (readable && !dbus_connection_read_write(connection, 0)) {
+    return false;
+  }
+  while (dbus_connection_dispatch(connection) == DBUS_DISPATCH_DATA_REMAINS) {
+  }
+  return !serviceMissing && dbus_connection_get_is_connected(connection);
+}
+
+#else
+
+using namespace std;
+
+unique_ptr<DBusInhibitBackend> DBusInhibitBackend::create() { return nullptr; }
+
+DBusInhibitBackend::DBusInhibitBackend(DBusConnection *connection)
+    : connection(connection) {}
+
+DBusInhibitBackend::~DBusInhibitBackend() {}
+
+bool DBusInhibitBackend::prepare() { return false; }
+
+bool DBusInhibitBackend::dispatch(bool) { return false; }
+
+void DBusInhibitBackend::inhibit() {}
+
+void DBusInhibitBackend::uninhibit() {}
+
+bool DBusInhibitBackend::waitForService() { return false; }
+
+void DBusInhibitBackend::onOwnerReply(bool, bool) {}
+
+void DBusInhibitBackend::onInhibitReply(bool, uint32_t) {}
+
+#endif
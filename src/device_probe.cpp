@@ -0,0 +1,266 @@
+#include "device_probe.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <linux/input.h>
+#include <memory>
+#include <mutex>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define LONGS_FOR(bits) (((bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static bool testBit(const unsigned long *bits, unsigned int bit) {
+  return (bits[bit / BITS_PER_LONG] >> (bit % BITS_PER_LONG)) & 1;
+}
+
+ProbeResult probeNode(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    return ProbeResult::Failed;
+  }
+  unsigned long keys[LONGS_FOR(KEY_CNT)] = {};
+  unsigned long axes[LONGS_FOR(ABS_CNT)] = {};
+  unsigned long props[LONGS_FOR(INPUT_PROP_CNT)] = {};
+  bool ok = ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) >= 0 &&
+            ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(axes)), axes) >= 0 &&
+            ioctl(fd, EVIOCGPROP(sizeof(props)), props) >= 0;
+  close(fd);
+  if (!ok) {
+    return ProbeResult::Failed;
+  }
+  if (testBit(props, INPUT_PROP_ACCELEROMETER)) {
+    return ProbeResult::Motion;
+  }
+  if (testBit(keys, BTN_SOUTH) && testBit(axes, ABS_X) &&
+      testBit(axes, ABS_Y)) {
+    return ProbeResult::Gamepad;
+  }
+  if (testBit(keys, BTN_TOUCH) && testBit(axes, ABS_MT_POSITION_X)) {
+    return ProbeResult::Touchpad;
+  }
+  return ProbeResult::Other;
+}
+
+static string readLine(const filesystem::path &path) {
+  ifstream file(path);
+  string line;
+  getline(file, line);
+  return line;
+}
+
+string probeCacheKey(const string &path) {
+  filesystem::path device = filesystem::path("/sys/class/input") /
+                            filesystem::path(path).filename() / "device";
+  string vendor = readLine(device / "id" / "vendor");
+  if (vendor.empty()) {
+    return string();
+  }
+  return vendor + ":" + readLine(device / "id" / "product") + ":" +
+         readLine(device / "uniq") + ":" + readLine(device / "name");
+}
+
+string controllerKey(const string &path) {
+  filesystem::path device = filesystem::path("/sys/class/input") /
+                            filesystem::path(path).filename() / "device";
+  string uniq = readLine(device / "uniq");
+  if (!uniq.empty()) {
+    return "uniq:" + uniq;
+  }
+  string phys = readLine(device / "phys");
+  if (!phys.empty()) {
+    return "phys:" + phys;
+  }
+  return "path:" + path;
+}
+
+string deviceSeat(const string &path) {
+  string number = readLine(filesystem::path("/sys/class/input") /
+                           filesystem::path(path).filename() / "dev");
+  if (!number.empty()) {
+    ifstream data("/run/udev/data/c" + number);
+    string line;
+    while (getline(data, line)) {
+      if (line.compare(0, 10, "E:ID_SEAT=") == 0 && line.size() > 10) {
+        return line.substr(10);
+      }
+    }
+  }
+  return "seat0";
+}
+
+filesystem::path defaultProbeCachePath() {
+  const char *cache = getenv("XDG_CACHE_HOME");
+  if (cache && *cache) {
+    return filesystem::path(cache) / "waypad" / "devices";
+  }
+  const char *home = getenv("HOME");
+  if (home && *home) {
+    return filesystem::path(home) / ".cache" / "waypad" / "devices";
+  }
+  return filesystem::path();
+}
+
+enum class ProbeState : uint8_t { Queued, Running, Done, Abandoned };
+
+// Shared with the workers, which are detached: a worker stuck in open()
+// or an ioctl outlives the scan that started it and must still have
+// somewhere to write.
+struct ProbeJob {
+  explicit ProbeJob(const vector<string> &paths)
+      : paths(paths), results(paths.size(), ProbeResult::Failed),
+        states(paths.size(), ProbeState::Queued), started(paths.size()) {}
+
+  mutex lock;
+  condition_variable changed;
+  vector<string> paths;
+  vector<ProbeResult> results;
+  vector<ProbeState> states;
+  vector<chrono::steady_clock::time_point> started;
+  size_t next = 0;
+  size_t settled = 0;
+};
+
+static void probeWorker(shared_ptr<ProbeJob> job) {
+  unique_lock<mutex> guard(job->lock);
+  while (job->next < job->paths.size()) {
+    size_t index = job->next++;
+    job->states[index] = ProbeState::Running;
+    job->started[index] = chrono::steady_clock::now();
+    guard.unlock();
+    ProbeResult result = probeNode(job->paths[index]);
+    guard.lock();
+    // A replacement worker has taken over the rest of the queue.
+    if (job->states[index] == ProbeState::Abandoned) {
+      return;
+    }
+    job->results[index] = result;
+    job->states[index] = ProbeState::Done;
+    job->settled++;
+    job->changed.notify_one();
+  }
+}
+
+// Each node gets PROBE_TIMEOUT from the moment a worker picks it up. A
+// node that overruns is given up on and its worker is replaced, so the
+// queue keeps draining at full width.
+static vector<ProbeResult> probeAll(const vector<string> &paths,
+                                    size_t workers, size_t &timedOut) {
+  auto job = make_shared<ProbeJob>(paths);
+  unique_lock<mutex> guard(job->lock);
+  for (size_t i = 0; i < min(workers, paths.size()); i++) {
+    std::thread(probeWorker, job).detach();
+  }
+  while (job->settled < paths.size()) {
+    auto now = chrono::steady_clock::now();
+    auto wake = now + PROBE_TIMEOUT;
+    for (size_t i = 0; i < paths.size(); i++) {
+      if (job->states[i] != ProbeState::Running) {
+        continue;
+      }
+      auto deadline = job->started[i] + PROBE_TIMEOUT;
+      if (deadline <= now) {
+        job->states[i] = ProbeState::Abandoned;
+        job->settled++;
+        timedOut++;
+        if (job->next < paths.size()) {
+          std::thread(probeWorker, job).detach();
+        }
+      } else {
+        wake = min(wake, deadline);
+      }
+    }
+    if (job->settled < paths.size()) {
+      job->changed.wait_until(guard, wake);
+    }
+  }
+  return job->results;
+}
+
+DeviceProbe::DeviceProbe(filesystem::path cacheFile)
+    : cacheFile(move(cacheFile)) {
+  load();
+}
+
+// One node per line: the ProbeResult as a digit, a space, and the key.
+// Failed results are never stored.
+void DeviceProbe::load() {
+  if (cacheFile.empty()) {
+    return;
+  }
+  ifstream file(cacheFile);
+  string line;
+  while (getline(file, line)) {
+    int result = line.empty() ? -1 : line[0] - '0';
+    if (line.size() > 2 && result >= 0 &&
+        result < static_cast<int>(ProbeResult::Failed) && line[1] == ' ') {
+      cache[line.substr(2)] = static_cast<ProbeResult>(result);
+    }
+  }
+}
+
+bool DeviceProbe::save() {
+  if (!dirty || cacheFile.empty()) {
+    return true;
+  }
+  error_code ec;
+  filesystem::create_directories(cacheFile.parent_path(), ec);
+  string temporary = cacheFile.string() + ".tmp";
+  {
+    ofstream file(temporary, ios::trunc);
+    if (!file) {
+      return false;
+    }
+    for (const auto &[key, result] : cache) {
+      file << static_cast<int>(result) << ' ' << key << '\n';
+    }
+    if (!file.flush()) {
+      return false;
+    }
+  }
+  if (rename(temporary.c_str(), cacheFile.c_str()) != 0) {
+    return false;
+  }
+  dirty = false;
+  return true;
+}
+
+vector<ProbeResult> DeviceProbe::classify(const vector<string> &nodes,
+                                          bool parallel) {
+  vector<string> keys(nodes.size());
+  vector<ProbeResult> results(nodes.size(), ProbeResult::Failed);
+  vector<string> unknown;
+  vector<size_t> unknownIndex;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    keys[i] = probeCacheKey(nodes[i]);
+    auto cached = keys[i].empty() ? cache.end() : cache.find(keys[i]);
+    if (cached != cache.end()) {
+      results[i] = cached->second;
+      counters.cacheHits++;
+    } else {
+      unknown.push_back(nodes[i]);
+      unknownIndex.push_back(i);
+    }
+  }
+
+  if (!unknown.empty()) {
+    vector<ProbeResult> probed =
+        probeAll(unknown, parallel ? PROBE_WORKERS : 1, counters.timedOut);
+    counters.probed += unknown.size();
+    for (size_t i = 0; i < probed.size(); i++) {
+      size_t index = unknownIndex[i];
+      results[index] = probed[i];
+      if (probed[i] != ProbeResult::Failed && !keys[index].empty()) {
+        cache[keys[index]] = probed[i];
+        dirty = true;
+      }
+    }
+  }
+  return results;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// A node whose open() or ioctls take longer than this is skipped for the
+// current scan; a later hotplug event for it is probed again.
+#define PROBE_TIMEOUT std::chrono::milliseconds(500)
+#define PROBE_WORKERS 16
+
+enum class ProbeResult { Other, Gamepad, Touchpad, Motion, Failed };
+
+// Classifies an event node by its capability bits: a gamepad reports
+// BTN_SOUTH (which is also BTN_GAMEPAD) and has at least the ABS_X and
+// ABS_Y axes, a motion sensor carries INPUT_PROP_ACCELEROMETER and a
+// touchpad reports BTN_TOUCH with multitouch positions. Touchpads and
+// motion sensors only matter when they belong to a gamepad. Failed means
+// the node could not be opened or queried.
+ProbeResult probeNode(const std::string &path);
+
+// The identity of an event node as sysfs reports it, readable without
+// opening the node: vendor, product, uniq and the device name, which
+// separates the several nodes one USB receiver exposes. Empty when sysfs
+// has no entry for the node.
+std::string probeCacheKey(const std::string &path);
+
+// What groups the nodes of one physical controller: its uniq string
+// (usually the Bluetooth address) or else its phys path, which drivers
+// share across all of a controller's nodes. Nodes with neither, such as
+// uinput devices, form a group of their own.
+std::string controllerKey(const std::string &path);
+
+// The seat udev assigned the node to (ID_SEAT in udev's database, which
+// logind's rules fill in from `loginctl attach`), or seat0 when it has
+// none.
+std::string deviceSeat(const std::string &path);
+
+std::filesystem::path defaultProbeCachePath();
+
+struct ProbeStats {
+  size_t cacheHits = 0;
+  size_t probed = 0;
+  size_t timedOut = 0;
+};
+
+// Classifies a set of event nodes. Nodes whose identity is
+// in the cache are classified without being opened; the rest are probed
+// by up to PROBE_WORKERS threads at once, so one slow node does not hold
+// up the others.
+class DeviceProbe {
+public:
+  explicit DeviceProbe(
+      std::filesystem::path cacheFile = defaultProbeCachePath());
+  std::vector<ProbeResult> classify(const std::vector<std::string> &nodes,
+                                    bool parallel = true);
+  bool save();
+  const ProbeStats &stats() const { return counters; }
+
+private:
+  void load();
+
+  std::filesystem::path cacheFile;
+  std::unordered_map<std::string, ProbeResult> cache;
+  bool dirty = false;
+  ProbeStats counters;
+};
@@ -0,0 +1,547 @@
+#include "device_registry.h"
+#include "diagnostics.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "recording.h"
+#include "remapper.h"
+#include "state_snapshot.h"
+#include "status_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace std;
+
+static bool isEventNode(const string &name) {
+  return name.compare(0, 5, "event") == 0;
+}
+
+static_assert(SNAPSHOT_SLOTS >= MAX_DEVICES,
+              "every device needs a shared state slot");
+
+DeviceRegistry::DeviceRegistry(int epollFd) : epollFd(epollFd) {
+  devices.reserve(MAX_DEVICES);
+  gone.reserve(MAX_DEVICES);
+  fill(begin(activityTime), end(activityTime),
+       chrono::steady_clock::time_point::max());
+}
+
+void DeviceRegistry::setBackend(InputBackend backend) {
+  this->backend = backend;
+  if (backend != InputBackend::IoUring || uring) {
+    return;
+  }
+  uring = UringReader::create();
+  if (!uring || !addToEpoll(epollFd, uring->notifyFd(),
+                            epollTag(EventSource::Uring))) {
+    cerr << "io_uring multishot reads unavailable, falling back to epoll"
+         << endl;
+    uring.reset();
+    this->backend = InputBackend::Raw;
+  }
+}
+
+DeviceRegistry::~DeviceRegistry() {
+  if (inotifyFd != -1) {
+    close(inotifyFd);
+  }
+  if (remapTimerFd != -1) {
+    close(remapTimerFd);
+  }
+  if (motionTimerFd != -1) {
+    close(motionTimerFd);
+  }
+}
+
+// Controllers opened from now on are grabbed and translated through table,
+// which has to outlive the registry.
+bool DeviceRegistry::setRemap(const RemapTable *table) {
+  if (remapTimerFd == -1) {
+    remapTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (remapTimerFd == -1 ||
+        !addToEpoll(epollFd, remapTimerFd, epollTag(EventSource::RemapTimer))) {
+      return false;
+    }
+  }
+  remapTable = table;
+  return true;
+}
+
+// Motion nodes are ignored unless a rate is set; with one, they are
+// attached to their controllers from the next scan on.
+bool DeviceRegistry::setMotionRate(double hz) {
+  if (hz <= 0.0) {
+    return true;
+  }
+  if (motionTimerFd == -1) {
+    motionTimerFd =
+        timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (motionTimerFd == -1 ||
+        !addToEpoll(epollFd, motionTimerFd,
+                    epollTag(EventSource::MotionTimer))) {
+      return false;
+    }
+  }
+  motionInterval = chrono::duration_cast<chrono::steady_clock::duration>(
+      chrono::duration<double>(1.0 / hz));
+  return true;
+}
+
+// Nodes are probed on IN_CREATE and again on IN_ATTRIB, because udev only
+// grants access to a new node a moment after the kernel creates it.
+bool DeviceRegistry::watch(const filesystem::path &inputFolder) {
+  this->inputFolder = inputFolder;
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd == -1) {
+    return false;
+  }
+  inputWatch = inotify_add_watch(inotifyFd, inputFolder.c_str(),
+                                 IN_CREATE | IN_ATTRIB);
+  if (inputWatch == -1 ||
+      !addToEpoll(epollFd, inotifyFd, epollTag(EventSource::Hotplug))) {
+    close(inotifyFd);
+    inotifyFd = -1;
+    return false;
+  }
+  scan(inputFolder);
+  return true;
+}
+
+void DeviceRegistry::handleHotplug() {
+  alignas(struct inotify_event) char buffer[4096];
+  vector<string> nodes;
+  bool overflow = false;
+  while (true) {
+    ssize_t length = read(inotifyFd, buffer, sizeof(buffer));
+    if (length <= 0) {
+      break;
+    }
+    for (char *ptr = buffer; ptr < buffer + length;) {
+      const struct inotify_event *event =
+          reinterpret_cast<const struct inotify_event *>(ptr);
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        overflow = true;
+      } else if (event->wd == inputWatch && event->len > 0 &&
+                 !(event->mask & IN_ISDIR) && isEventNode(event->name)) {
+        string path = (inputFolder / event->name).string();
+        if (!contains(path) &&
+            find(nodes.begin(), nodes.end(), path) == nodes.end()) {
+          nodes.push_back(path);
+        }
+      }
+    }
+  }
+  if (overflow) {
+    scan(inputFolder);
+  } else if (!nodes.empty()) {
+    addGamepads(nodes);
+  }
+}
+
+size_t DeviceRegistry::scan(const filesystem::path &inputFolder) {
+  vector<string> nodes;
+  error_code ec;
+  for (const auto &entry : filesystem::directory_iterator(inputFolder, ec)) {
+    string path = entry.path().string();
+    if (isEventNode(entry.path().filename().string()) && !contains(path)) {
+      nodes.push_back(path);
+    }
+  }
+  return addGamepads(nodes);
+}
+
+// Buttons nodes go first so that siblings found in the same scan have a
+// controller to join.
+size_t DeviceRegistry::addGamepads(const vector<string> &nodes) {
+  vector<ProbeResult> results = probe.classify(nodes);
+  size_t added = 0;
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (results[i] == ProbeResult::Gamepad && add(nodes[i])) {
+      added++;
+    }
+  }
+  for (size_t i = 0; i < nodes.size(); i++) {
+    if (results[i] == ProbeResult::Touchpad) {
+      addSibling(nodes[i], NodeRole::Touchpad);
+    } else if (results[i] == ProbeResult::Motion &&
+               motionInterval != chrono::steady_clock::duration::zero()) {
+      addSibling(nodes[i], NodeRole::Motion);
+    }
+  }
+  if (!probe.save()) {
+    cerr << "Failed to write the device probe cache" << endl;
+  }
+  return added;
+}
+
+// Laptop touchpads and other unrelated sensors end up as spares that never
+// find their controller, which costs nothing but the entry.
+void DeviceRegistry::addSibling(const string &path, NodeRole role) {
+  string key = controllerKey(path);
+  auto controller = controllers.find(key);
+  if (controller != controllers.end()) {
+    attach(controller->second, path, role);
+    return;
+  }
+  for (const SpareNode &spare : spares) {
+    if (spare.path == path) {
+      return;
+    }
+  }
+  spares.push_back(SpareNode{path, move(key), role});
+}
+
+void DeviceRegistry::attach(PhysicalController &controller,
+                            const string &path, NodeRole role) {
+  if (role != NodeRole::Motion) {
+    if (!contains(path)) {
+      add(path, role);
+    }
+    return;
+  }
+  if (controller.motion) {
+    return;
+  }
+  try {
+    controller.motion = make_unique<MotionSensor>(path);
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return;
+  }
+  logStatus("Game controller motion sensor connected", path.c_str());
+  if (motionSensors++ == 0) {
+    armInterval(motionTimerFd, motionInterval);
+  }
+}
+
+bool DeviceRegistry::add(const string &path, NodeRole role) {
+  if (devices.size() == MAX_DEVICES) {
+    cerr << "Not opening " << path << ": already tracking " << MAX_DEVICES
+         << " devices" << endl;
+    return false;
+  }
+  uint8_t seat = 0;
+  if (!findSeat(path, seat)) {
+    return false;
+  }
+  try {
+    Gamepad gamepad(path, backend, role);
+    gamepad.id = nextId++;
+    gamepad.seat = seat;
+    uint32_t index = static_cast<uint32_t>(devices.size());
+    bool watching = uring ? uring->arm(gamepad.fd())
+                          : addToEpoll(epollFd, gamepad.fd(),
+                                       epollTag(EventSource::Device, index));
+    if (!watching) {
+      cerr << "Failed to watch device " << path << ": " << strerror(errno)
+           << endl;
+      return false;
+    }
+    if (slotByFd.size() <= static_cast<size_t>(gamepad.fd())) {
+      slotByFd.resize(gamepad.fd() + 1, -1);
+    }
+    slotByFd[gamepad.fd()] = static_cast<int32_t>(index);
+    if (recorder) {
+      input_absinfo absinfo[AXIS_COUNT];
+      gamepad.getAbsInfo(absinfo);
+      recorder->writeDevice(gamepad.id,
+                            libevdev_get_id_vendor(gamepad.evdev.get()),
+                            libevdev_get_id_product(gamepad.evdev.get()),
+                            absinfo);
+    }
+    if (metrics) {
+      gamepad.metrics = metrics->addDevice(path);
+    }
+    if (diagnostics) {
+      gamepad.diagnostics = diagnostics->addDevice(path, gamepad);
+    }
+    if (remapTable && role == NodeRole::Buttons) {
+      // A controller that cannot be remapped still counts for idle
+      // inhibition.
+      try {
+        gamepad.remapper = make_unique<Remapper>(*remapTable);
+        if (libevdev_grab(gamepad.evdev.get(), LIBEVDEV_GRAB) < 0) {
+          cerr << "Failed to grab " << path
+               << ", other clients still see its input" << endl;
+        }
+      } catch (const exception &e) {
+        cerr << "Error: " << e.what() << endl;
+      }
+    }
+    string key = controllerKey(path);
+    auto [controller, created] = controllers.try_emplace(key);
+    controller->second.key = key;
+    controller->second.seat = seat;
+    controller->second.nodes++;
+    gamepad.controller = &controller->second;
+    if (snapshot) {
+      gamepad.snapshotSlot = snapshot->acquire(
+          path, libevdev_get_id_vendor(gamepad.evdev.get()),
+          libevdev_get_id_product(gamepad.evdev.get()), role);
+      snapshot->publish(gamepad.snapshotSlot, gamepad.model,
+                        gamepad.model.isActive(),
+                        chrono::steady_clock::time_point());
+    }
+    devices.push_back(move(gamepad));
+    logStatus(role == NodeRole::Buttons ? "Game controller connected"
+                                        : "Game controller touchpad connected",
+              path.c_str());
+
+    if (created) {
+      vector<SpareNode> siblings;
+      for (size_t i = 0; i < spares.size();) {
+        if (spares[i].key == key) {
+          siblings.push_back(move(spares[i]));
+          spares[i] = move(spares.back());
+          spares.pop_back();
+        } else {
+          i++;
+        }
+      }
+      for (const SpareNode &sibling : siblings) {
+        attach(controller->second, sibling.path, sibling.role);
+      }
+    }
+  } catch (const exception &e) {
+    cerr << "Error: " << e.what() << endl;
+    return false;
+  }
+  return true;
+}
+
+void DeviceRegistry::remove(size_t index) {
+  logStatus(devices[index].role == NodeRole::Buttons
+                ? "Game controller disconnected"
+                : "Game controller touchpad disconnected",
+            devices[index].path.c_str());
+  PhysicalController *controller = devices[index].controller;
+  if (controller && --controller->nodes == 0) {
+    if (controller->motion && --motionSensors == 0) {
+      disarmTimer(motionTimerFd);
+    }
+    string key = controller->key;
+    controllers.erase(key);
+  }
+  if (devices[index].active) {
+    activeCount--;
+    seatActive[devices[index].seat]--;
+  }
+  if (metrics) {
+    metrics->removeDevice(devices[index].metrics);
+  }
+  if (snapshot) {
+    snapshot->release(devices[index].snapshotSlot);
+  }
+  slotByFd[devices[index].fd()] = -1;
+  if (uring) {
+    uring->disarm(devices[index].fd());
+  } else {
+    epoll_ctl(epollFd, EPOLL_CTL_DEL, devices[index].fd(), nullptr);
+  }
+  size_t last = devices.size() - 1;
+  if (index != last) {
+    devices[index] = move(devices[last]);
+    slotByFd[devices[index].fd()] = static_cast<int32_t>(index);
+    if (!uring) {
+      struct epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.u64 =
+          epollTag(EventSource::Device, static_cast<uint32_t>(index));
+      epoll_ctl(epollFd, EPOLL_CTL_MOD, devices[index].fd(), &ev);
+    }
+  }
+  devices.pop_back();
+}
+
+bool DeviceRegistry::handleEpollEvent(uint64_t tag) {
+  switch (epollSource(tag)) {
+  case EventSource::Hotplug:
+    handleHotplug();
+    return false;
+  case EventSource::Device:
+    return handleEvents(epollIndex(tag));
+  case EventSource::Uring:
+    return handleUring();
+  case EventSource::RemapTimer:
+    handleRemapTick();
+    return false;
+  case EventSource::MotionTimer:
+    return handleMotionTick();
+  default:
+    return false;
+  }
+}
+
+bool DeviceRegistry::handleEvents(size_t index) {
+  Gamepad &gamepad = devices[index];
+  bool activity = false;
+  if (!gamepad.updateState(activity, recorder)) {
+    gone.push_back(index);
+    return activity;
+  }
+  return settle(index, activity);
+}
+
+bool DeviceRegistry::handleUring() {
+  bool activity = false;
+  uring->harvest([&](int fd, const input_event *events, size_t count,
+                     int error) {
+    if (fd < 0 || static_cast<size_t>(fd) >= slotByFd.size() ||
+        slotByFd[fd] < 0) {
+      return false;
+    }
+    size_t index = slotByFd[fd];
+    if (error != 0) {
+      if (error == ENODEV) {
+        gone.push_back(index);
+        return false;
+      }
+      return true;
+    }
+    Gamepad &gamepad = devices[index];
+    gamepad.inputTime = {};
+    gamepad.decodeRaw(events, count, recorder);
+    if (settle(index, gamepad.finishBatch())) {
+      activity = true;
+    }
+    return true;
+  });
+  return activity;
+}
+
+bool DeviceRegistry::settle(size_t index, bool activity) {
+  Gamepad &gamepad = devices[index];
+  if (gamepad.remapper && gamepad.remapper->isMoving() && !remapTicking) {
+    remapTicking = armInterval(remapTimerFd, REMAP_TICK);
+  }
+  if (activity && gamepad.inputTime != chrono::steady_clock::time_point()) {
+    activityTime[gamepad.seat] =
+        min(activityTime[gamepad.seat], gamepad.inputTime);
+    if (gamepad.metrics) {
+      gamepad.metrics->activeBatches.add();
+      gamepad.metrics->detectionLatency.observe(
+          chrono::steady_clock::now() - gamepad.inputTime);
+    }
+  }
+  bool active = gamepad.isActive();
+  if (active != gamepad.active) {
+    gamepad.active = active;
+    if (active) {
+      activeCount++;
+      seatActive[gamepad.seat]++;
+    } else {
+      activeCount--;
+      seatActive[gamepad.seat]--;
+    }
+  }
+  if (snapshot) {
+    snapshot->publish(gamepad.snapshotSlot, gamepad.model, active,
+                      activity ? gamepad.inputTime
+                               : chrono::steady_clock::time_point());
+  }
+  return activity;
+}
+
+// Keeps deflected sticks moving the pointer between read batches; the
+// timer stops once every stick is back in its deadzone.
+void DeviceRegistry::handleRemapTick() {
+  uint64_t expirations;
+  if (read(remapTimerFd, &expirations, sizeof(expirations)) !=
+      sizeof(expirations)) {
+    return;
+  }
+  auto now = chrono::steady_clock::now();
+  bool moving = false;
+  for (Gamepad &gamepad : devices) {
+    if (gamepad.remapper) {
+      gamepad.remapper->tick(now);
+      moving |= gamepad.remapper->isMoving();
+    }
+  }
+  if (!moving) {
+    disarmTimer(remapTimerFd);
+    remapTicking = false;
+  }
+}
+
+// A moving controller counts as input at the time of the sample; the IMU
+// stream is never read, so there is no kernel timestamp to use.
+bool DeviceRegistry::handleMotionTick() {
+  uint64_t expirations;
+  if (read(motionTimerFd, &expirations, sizeof(expirations)) !=
+      sizeof(expirations)) {
+    return false;
+  }
+  bool activity = false;
+  auto now = chrono::steady_clock::now();
+  for (auto &[key, controller] : controllers) {
+    if (!controller.motion) {
+      continue;
+    }
+    bool moving = false;
+    if (!controller.motion->sample(moving)) {
+      logStatus("Game controller motion sensor disconnected",
+                controller.motion->path.c_str());
+      controller.motion.reset();
+      if (--motionSensors == 0) {
+        disarmTimer(motionTimerFd);
+      }
+    }
+    if (moving) {
+      activity = true;
+      activityTime[controller.seat] = min(activityTime[controller.seat], now);
+    }
+  }
+  return activity;
+}
+
+// The kernel timestamp of the earliest input on the seat that showed
+// activity since the last call, or time_point::max() if there was none.
+chrono::steady_clock::time_point DeviceRegistry::takeActivityTime(size_t seat) {
+  auto time = activityTime[seat];
+  activityTime[seat] = chrono::steady_clock::time_point::max();
+  return time;
+}
+
+// Looked up before the node is opened, so a controller on a seat this
+// daemon does not serve is never grabbed or read.
+bool DeviceRegistry::findSeat(const string &path, uint8_t &seat) const {
+  if (seats.empty()) {
+    return true;
+  }
+  string name = deviceSeat(path);
+  auto it = find(seats.begin(), seats.end(), name);
+  if (it == seats.end()) {
+    logStatus("Ignoring controller on unserved seat", path.c_str());
+    return false;
+  }
+  seat = static_cast<uint8_t>(it - seats.begin());
+  return true;
+}
+
+// Removal swaps the last device into the freed slot, so it is deferred
+// until the current epoll batch is processed and done highest index first.
+void DeviceRegistry::reap() {
+  if (gone.empty()) {
+    return;
+  }
+  sort(gone.begin(), gone.end(), greater<size_t>());
+  for (size_t index : gone) {
+    remove(index);
+  }
+  gone.clear();
+}
+
+bool DeviceRegistry::contains(const string &path) const {
+  for (const Gamepad &gamepad : devices) {
+    if (gamepad.path == path) {
+      return true;
+    }
+  }
+  return false;
+}
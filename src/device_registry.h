@@ -0,0 +1,117 @@
+#pragma once
+
+#include "device_probe.h"
+#include "gamepad.h"
+#include "physical_controller.h"
+#include "uring_reader.h"
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Owns every open controller. Devices live contiguously in a vector and
+// their epoll registration carries the slot index, so a wakeup only touches
+// the devices that actually have pending events. Arrivals are reported by
+// inotify on /dev/input and classified by DeviceProbe from their
+// capabilities; departures show up as ENODEV on read. A controller's
+// touchpad and motion nodes are grouped with its buttons node into one
+// PhysicalController and are only opened once that node is. With
+// the io_uring backend device fds are not in the epoll set at all and their
+// completions are looked up by fd instead.
+// Capacity for MAX_DEVICES is reserved up front, so opening a device never
+// reallocates the vector, but removing one moves the last device into its
+// slot, changing that device's index and address. Opening a device still
+// allocates its path, libevdev handle, remapper and controller entry;
+// only reading from open devices touches no allocator.
+// A controller is opened as its buttons node plus, like the DualSense, a
+// touchpad node; motion sensors are held by the PhysicalController.
+#define MAX_CONTROLLERS 32
+#define MAX_DEVICES (MAX_CONTROLLERS * 2)
+// With setSeats() each controller is routed to the seat udev assigned it
+// to, and activity is tracked per seat; nodes on other seats are never
+// opened. Without it everything counts for seat index 0.
+#define MAX_SEATS 8
+
+class Diagnostics;
+class Metrics;
+class StateSnapshot;
+struct RemapTable;
+
+class DeviceRegistry {
+public:
+  explicit DeviceRegistry(int epollFd);
+  ~DeviceRegistry();
+  bool watch(const std::filesystem::path &inputFolder);
+  void handleHotplug();
+  size_t scan(const std::filesystem::path &inputFolder);
+  bool add(const std::string &path, NodeRole role = NodeRole::Buttons);
+  void remove(size_t index);
+  bool handleEpollEvent(uint64_t tag);
+  bool handleEvents(size_t index);
+  void reap();
+  bool isAnyActive() const { return activeCount > 0; }
+  bool isActive(size_t seat) const { return seatActive[seat] > 0; }
+  void setRecorder(RecordingWriter *recorder) { this->recorder = recorder; }
+  void setBackend(InputBackend backend);
+  void setMetrics(Metrics *metrics) { this->metrics = metrics; }
+  void setDiagnostics(Diagnostics *diagnostics) {
+    this->diagnostics = diagnostics;
+  }
+  void setSnapshot(StateSnapshot *snapshot) { this->snapshot = snapshot; }
+  bool setRemap(const RemapTable *table);
+  bool setMotionRate(double hz);
+  void setSeats(const std::vector<std::string> &names) { seats = names; }
+  size_t seatCount() const { return seats.empty() ? 1 : seats.size(); }
+  std::chrono::steady_clock::time_point takeActivityTime(size_t seat = 0);
+  bool contains(const std::string &path) const;
+  size_t size() const { return devices.size(); }
+  bool empty() const { return devices.empty(); }
+
+private:
+  // A touchpad or motion node whose buttons node has not shown up yet.
+  struct SpareNode {
+    std::string path;
+    std::string key;
+    NodeRole role;
+  };
+
+  size_t addGamepads(const std::vector<std::string> &nodes);
+  void addSibling(const std::string &path, NodeRole role);
+  void attach(PhysicalController &controller, const std::string &path,
+              NodeRole role);
+  bool handleMotionTick();
+  bool handleUring();
+  bool settle(size_t index, bool activity);
+  bool findSeat(const std::string &path, uint8_t &seat) const;
+  void handleRemapTick();
+
+  int epollFd;
+  int inotifyFd = -1;
+  int inputWatch = -1;
+  std::filesystem::path inputFolder;
+  DeviceProbe probe;
+  std::vector<Gamepad> devices;
+  // Node-based, so the pointers Gamepads keep stay valid.
+  std::unordered_map<std::string, PhysicalController> controllers;
+  std::vector<SpareNode> spares;
+  std::vector<size_t> gone;
+  size_t activeCount = 0;
+  size_t seatActive[MAX_SEATS] = {};
+  std::vector<std::string> seats;
+  RecordingWriter *recorder = nullptr;
+  Metrics *metrics = nullptr;
+  Diagnostics *diagnostics = nullptr;
+  StateSnapshot *snapshot = nullptr;
+  const RemapTable *remapTable = nullptr;
+  int remapTimerFd = -1;
+  bool remapTicking = false;
+  int motionTimerFd = -1;
+  std::chrono::steady_clock::duration motionInterval{};
+  size_t motionSensors = 0;
+  std::chrono::steady_clock::time_point activityTime[MAX_SEATS];
+  InputBackend backend = InputBackend::Libevdev;
+  std::unique_ptr<UringReader> uring;
+  std::vector<int32_t> slotByFd;
+  uint16_t nextId = 0;
+};
@@ -0,0 +1,199 @@
+#include "diagnostics.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+using namespace std;
+
+// Gaps longer than this many median intervals are taken as the controller
+// having nothing to report, since the kernel drops frames in which no value
+// changed, rather than as lost reports.
+#define PAUSE_FACTOR 8
+// Shorter gaps are jitter; anything between this and PAUSE_FACTOR median
+// intervals counts the reports that should have filled it as missing.
+#define MISSED_FACTOR 1.5
+
+void AxisNoise::add(float value) {
+  if (samples++ == 0) {
+    minimum = maximum = value;
+  } else {
+    minimum = min(minimum, value);
+    maximum = max(maximum, value);
+  }
+  double delta = value - mean;
+  mean += delta / samples;
+  m2 += delta * (value - mean);
+}
+
+double AxisNoise::stddev() const {
+  return samples > 1 ? sqrt(m2 / (samples - 1)) : 0.0;
+}
+
+static string deviceName(const libevdev *dev) {
+  const char *name = libevdev_get_name(dev);
+  return name ? name : "";
+}
+
+DeviceDiagnostics::DeviceDiagnostics(const string &path,
+                                     const Gamepad &gamepad)
+    : path(path), name(deviceName(gamepad.evdev.get())),
+      profile(gamepad.model.profile->name ? gamepad.model.profile->name
+                                          : "generic"),
+      vendor(libevdev_get_id_vendor(gamepad.evdev.get())),
+      product(libevdev_get_id_product(gamepad.evdev.get())),
+      role(gamepad.role) {
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    scales[i] = gamepad.model.axisScales[i];
+    hasAxis[i] = role == NodeRole::Buttons && scales[i].scale != 0.0f;
+  }
+  // A minute at 1000 Hz, so a typical run never reallocates.
+  intervals.reserve(60000);
+}
+
+// An axis is sampled on every report while it sits where the activity
+// check would call it released, which is the noise that check has to
+// ride out.
+void DeviceDiagnostics::onReport(chrono::steady_clock::time_point time,
+                                 const GamepadModel &model) {
+  if (reports++ == 0) {
+    firstReport = time;
+  }
+  if (chained && time > lastReport) {
+    auto gap = chrono::duration_cast<chrono::microseconds>(time - lastReport);
+    intervals.push_back(
+        static_cast<uint32_t>(min<int64_t>(gap.count(), UINT32_MAX)));
+  }
+  lastReport = time;
+  chained = true;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!hasAxis[i]) {
+      continue;
+    }
+    bool trigger = i == ABS_Z || i == ABS_RZ;
+    float radius = trigger ? TRIGGER_EXIT_RADIUS : STICK_EXIT_RADIUS;
+    if (fabs(model.state.axes[i] - model.centre[i]) <= radius) {
+      noise[i].add(model.state.axes[i]);
+    }
+  }
+}
+
+void DeviceDiagnostics::onDropped() {
+  synDropped++;
+  chained = false;
+}
+
+static uint32_t percentile(const vector<uint32_t> &sorted, double p) {
+  size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[min(index, sorted.size() - 1)];
+}
+
+// The usual USB polling rates, which Bluetooth pads tend to approximate.
+static int nominalRate(double hz) {
+  static const int rates[] = {125, 250, 500, 1000, 2000, 4000, 8000};
+  for (int rate : rates) {
+    if (fabs(hz - rate) <= rate * 0.1) {
+      return rate;
+    }
+  }
+  return 0;
+}
+
+static const char *axisName(int slot) {
+  static const char *names[AXIS_COUNT] = {
+      "left X", "left Y", "left trigger", "right X", "right Y", "right trigger"};
+  return names[slot];
+}
+
+void DeviceDiagnostics::write(ostream &out) const {
+  out << path << ": " << name << " (" << hex << setfill('0') << setw(4)
+      << vendor << ":" << setw(4) << product << dec << setfill(' ')
+      << ", profile " << profile << ")\n";
+  double span = chrono::duration<double>(lastReport - firstReport).count();
+  out << "  reports       " << reports;
+  if (reports > 1) {
+    out << " over " << fixed << setprecision(1) << span << " s";
+  }
+  out << "\n";
+  out << "  SYN_DROPPED   " << synDropped << "\n";
+  if (intervals.size() < 2) {
+    out << "  too few reports to measure the rate; keep a stick moving while "
+           "it runs\n";
+    return;
+  }
+
+  vector<uint32_t> sorted = intervals;
+  sort(sorted.begin(), sorted.end());
+  uint32_t median = max<uint32_t>(percentile(sorted, 0.5), 1);
+  // Pauses say nothing about the polling rate, so the rest of the
+  // statistics leave them out.
+  auto pauses =
+      upper_bound(sorted.begin(), sorted.end(), median * PAUSE_FACTOR);
+  size_t pauseCount = sorted.end() - pauses;
+  sorted.erase(pauses, sorted.end());
+  uint64_t missed = 0;
+  vector<uint32_t> jitter;
+  jitter.reserve(sorted.size());
+  for (uint32_t interval : sorted) {
+    jitter.push_back(interval > median ? interval - median : median - interval);
+    if (interval >= median * MISSED_FACTOR) {
+      missed += lround(double(interval) / median) - 1;
+    }
+  }
+  sort(jitter.begin(), jitter.end());
+
+  double hz = 1e6 / median;
+  out << "  rate          " << fixed << setprecision(1) << hz
+      << " Hz (median interval " << median << " us)";
+  if (int nominal = nominalRate(hz)) {
+    out << ", nominal " << nominal << " Hz";
+  }
+  out << "\n";
+  out << "  interval us   min " << sorted.front() << " / p1 "
+      << percentile(sorted, 0.01) << " / p50 " << percentile(sorted, 0.5)
+      << " / p99 " << percentile(sorted, 0.99) << " / max " << sorted.back()
+      << "\n";
+  out << "  jitter us     p50 " << percentile(jitter, 0.5) << " / p99 "
+      << percentile(jitter, 0.99) << " / max " << jitter.back()
+      << " from the median\n";
+  out << "  missed        " << missed << " reports (" << setprecision(2)
+      << 100.0 * missed / (sorted.size() + missed) << "%)";
+  if (pauseCount > 0) {
+    out << ", not counting " << pauseCount << " gaps over " << PAUSE_FACTOR
+        << "x the median";
+  }
+  out << "\n";
+
+  bool header = false;
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    if (!hasAxis[i] || noise[i].samples < 2) {
+      continue;
+    }
+    if (!header) {
+      out << "  noise at rest stddev / peak-to-peak in raw units\n";
+      header = true;
+    }
+    double scale = fabs(scales[i].scale);
+    out << "    " << left << setw(14) << axisName(i) << right
+        << setprecision(2) << noise[i].stddev() / scale << " / " << setprecision(0)
+        << (noise[i].maximum - noise[i].minimum) / scale << " ("
+        << noise[i].samples << " samples)\n";
+  }
+  out << defaultfloat << setprecision(6);
+}
+
+DeviceDiagnostics *Diagnostics::addDevice(const string &path,
+                                          const Gamepad &gamepad) {
+  devices.emplace_back(path, gamepad);
+  return &devices.back();
+}
+
+void Diagnostics::write(ostream &out) const {
+  if (devices.empty()) {
+    out << "No game controller was seen" << endl;
+    return;
+  }
+  for (const DeviceDiagnostics &device : devices) {
+    device.write(out);
+  }
+  out.flush();
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "gamepad.h"
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Running mean and spread of one axis while it sits inside its rest zone,
+// in normalised units.
+struct AxisNoise {
+  uint64_t samples = 0;
+  double mean = 0.0;
+  double m2 = 0.0;
+  float minimum = 0.0f;
+  float maximum = 0.0f;
+
+  void add(float value);
+  double stddev() const;
+};
+
+// What --diagnose collects for one event node, fed by the Gamepad reading
+// it on every SYN_REPORT and SYN_DROPPED. Timestamps are the kernel's, so
+// they show when the controller's reports arrived rather than when waypad
+// got around to reading them.
+struct DeviceDiagnostics {
+  DeviceDiagnostics(const std::string &path, const Gamepad &gamepad);
+  void onReport(std::chrono::steady_clock::time_point time,
+                const GamepadModel &model);
+  void onDropped();
+  void write(std::ostream &out) const;
+
+  std::string path;
+  std::string name;
+  std::string profile;
+  uint16_t vendor;
+  uint16_t product;
+  NodeRole role;
+  AxisScale scales[AXIS_COUNT];
+  bool hasAxis[AXIS_COUNT] = {};
+  uint64_t reports = 0;
+  uint64_t synDropped = 0;
+  // Microseconds between consecutive reports, the resolution of the
+  // kernel's timestamps. A SYN_DROPPED breaks the chain, since the reports
+  // in between were never seen.
+  std::vector<uint32_t> intervals;
+  std::chrono::steady_clock::time_point firstReport;
+  std::chrono::steady_clock::time_point lastReport;
+  bool chained = false;
+  AxisNoise noise[AXIS_COUNT];
+};
+
+// Owns the per-device collectors. Only the thread that reads the devices
+// touches it, and entries outlive their device so a controller unplugged
+// mid-run still shows up in the summary.
+class Diagnostics {
+public:
+  DeviceDiagnostics *addDevice(const std::string &path,
+                               const Gamepad &gamepad);
+  void write(std::ostream &out) const;
+
+private:
+  std::list<DeviceDiagnostics> devices;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+// Every fd in the main epoll set carries its source in the upper half of
+// the user data and, for devices, the registry slot in the lower half.
+enum class EventSource : uint32_t {
+  Inhibit,
+  Display,
+  Timer,
+  Hotplug,
+  Device,
+  Input,
+  Uring,
+  Signal,
+  MetricsTimer,
+  MetricsSocket,
+  RemapTimer,
+  MotionTimer,
+  ExitTimer
+};
+
+inline uint64_t epollTag(EventSource source, uint32_t index = 0) {
+  return static_cast<uint64_t>(source) << 32 | index;
+}
+
+inline EventSource epollSource(uint64_t tag) {
+  return static_cast<EventSource>(tag >> 32);
+}
+
+inline uint32_t epollIndex(uint64_t tag) { return static_cast<uint32_t>(tag); }
+
+inline bool addToEpoll(int epollFd, int fd, uint64_t tag) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.u64 = tag;
+  return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+inline bool armTimer(int timerFd, std::chrono::steady_clock::duration timeout) {
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(timeout).count();
+  if (ns <= 0) {
+    ns = 1;
+  }
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  return timerfd_settime(timerFd, 0, &spec, nullptr) == 0;
+}
+
+inline bool armInterval(int timerFd,
+                        std::chrono::steady_clock::duration interval) {
+  auto ns =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(interval).count();
+  struct itimerspec spec = {};
+  spec.it_value.tv_sec = ns / 1000000000;
+  spec.it_value.tv_nsec = ns % 1000000000;
+  spec.it_interval = spec.it_value;
+  return timerfd_settime(timerFd, 0, &spec, nullptr) == 0;
+}
+
+inline bool disarmTimer(int timerFd) {
+  struct itimerspec spec = {};
+  return timerfd_settime(timerFd, 0, &spec, nullptr) == 0;
+}
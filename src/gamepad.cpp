@@ -0,0 +1,342 @@
+#include "gamepad.h"
+#include "diagnostics.h"
+#include "metrics.h"
+#include "recording.h"
+#include "remapper.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std;
+
+GamepadModel::GamepadModel(const input_absinfo (&absinfo)[AXIS_COUNT],
+                           const ControllerProfile &profile)
+    : profile(&profile) {
+  for (unsigned int code = ABS_X; code <= ABS_RZ; code++) {
+    int maxValue = absinfo[code].maximum;
+    int minValue = absinfo[code].minimum;
+    AxisScale &axis = axisScales[code];
+    if (code == ABS_Z || code == ABS_RZ) {
+      if (maxValue > 0) {
+        axis.scale = 1.0f / maxValue;
+      }
+    } else if (maxValue > minValue) {
+      axis.scale = 2.0f / (maxValue - minValue);
+      axis.offset = -minValue * axis.scale - 1.0f;
+    }
+
+    // Whatever the controls report at open time is taken as their resting
+    // position.
+    state.axes[code] = absinfo[code].value * axis.scale + axis.offset;
+    centre[code] = clamp(state.axes[code], -MAX_DRIFT, MAX_DRIFT);
+  }
+  classify();
+}
+
+void GamepadModel::setButton(unsigned int bit, bool down) {
+  uint64_t mask = uint64_t(1) << bit;
+  state.buttons = down ? state.buttons | mask : state.buttons & ~mask;
+  pressed |= down;
+}
+
+// Touchpad contacts only count as momentary input: a finger resting on the
+// pad sends nothing, just like a held button.
+void GamepadModel::applyEvent(const input_event &ev) {
+  DecodeSlot slot = profile->decode(ev.type, ev.code);
+  if (slot.kind == DecodeKind::Axis) {
+    const AxisScale &axis = axisScales[slot.index];
+    state.axes[slot.index] = ev.value * axis.scale + axis.offset;
+  } else if (slot.kind == DecodeKind::Button) {
+    setButton(slot.index, ev.value != 0);
+  } else if (slot.kind == DecodeKind::Hat) {
+    setButton(slot.index, ev.value < 0);
+    setButton(slot.index + 1, ev.value > 0);
+  } else if (slot.kind == DecodeKind::Touch) {
+    pressed |= ev.value != 0;
+  } else if (slot.kind == DecodeKind::Contact) {
+    pressed = true;
+  } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
+    reports++;
+  }
+}
+
+// Groups are left stick, right stick, left trigger, right trigger. Every
+// step is a fixed-width loop over the four lanes so it vectorises and only
+// the final mask depends on the previous classification. Returns whether
+// the controller was active at any point since the last call, so a button
+// tapped and released within one batch still counts.
+bool GamepadModel::classify() {
+  static constexpr float enterLimit[GROUP_COUNT] = {
+      STICK_ENTER_RADIUS * STICK_ENTER_RADIUS,
+      STICK_ENTER_RADIUS * STICK_ENTER_RADIUS,
+      TRIGGER_ENTER_RADIUS * TRIGGER_ENTER_RADIUS,
+      TRIGGER_ENTER_RADIUS * TRIGGER_ENTER_RADIUS};
+  static constexpr float exitLimit[GROUP_COUNT] = {
+      STICK_EXIT_RADIUS * STICK_EXIT_RADIUS,
+      STICK_EXIT_RADIUS * STICK_EXIT_RADIUS,
+      TRIGGER_EXIT_RADIUS * TRIGGER_EXIT_RADIUS,
+      TRIGGER_EXIT_RADIUS * TRIGGER_EXIT_RADIUS};
+
+  float delta[AXIS_COUNT];
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    delta[i] = state.axes[i] - centre[i];
+  }
+
+  const float magnitude[GROUP_COUNT] = {
+      delta[ABS_X] * delta[ABS_X] + delta[ABS_Y] * delta[ABS_Y],
+      delta[ABS_RX] * delta[ABS_RX] + delta[ABS_RY] * delta[ABS_RY],
+      delta[ABS_Z] * delta[ABS_Z], delta[ABS_RZ] * delta[ABS_RZ]};
+
+  uint32_t groups = 0;
+  uint32_t resting = 0;
+  for (int i = 0; i < GROUP_COUNT; i++) {
+    bool wasActive = (activeGroups >> i) & 1;
+    float limit = wasActive ? exitLimit[i] : enterLimit[i];
+    groups |= uint32_t(magnitude[i] > limit) << i;
+    resting |= uint32_t(magnitude[i] <= enterLimit[i]) << i;
+  }
+  activeGroups = groups;
+
+  // A batch may hold any number of reports, so the centre moves as far as
+  // it would have done with the reading held over that many single-report
+  // batches.
+  float drift = reports <= 1 ? DRIFT_RATE * reports
+                             : 1.0f - powf(1.0f - DRIFT_RATE, reports);
+  reports = 0;
+  static constexpr int axisGroup[AXIS_COUNT] = {0, 0, 2, 1, 1, 3};
+  for (int i = 0; i < AXIS_COUNT; i++) {
+    float rate = ((resting >> axisGroup[i]) & 1) ? drift : 0.0f;
+    centre[i] = clamp(centre[i] + delta[i] * rate, -MAX_DRIFT, MAX_DRIFT);
+  }
+
+  bool activity = pressed || isActive();
+  pressed = false;
+  return activity;
+}
+
+static void freeEvdev(libevdev *dev) {
+  int fd = libevdev_get_fd(dev);
+  libevdev_free(dev);
+  close(fd);
+}
+
+Gamepad::Gamepad(const string &path, InputBackend backend, NodeRole role)
+    : path(path), backend(backend), role(role), evdev(nullptr, freeEvdev) {
+  int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+  if (fd == -1) {
+    throw runtime_error("Failed to open device: " + path);
+  }
+  libevdev *dev = nullptr;
+
+  int rc = libevdev_new_from_fd(fd, &dev);
+  if (rc < 0) {
+    close(fd);
+    throw runtime_error("Failed to initialize libevdev");
+  }
+
+  evdev = unique_ptr<libevdev, void (*)(libevdev *)>(dev, freeEvdev);
+  libevdev_set_clock_id(dev, CLOCK_MONOTONIC);
+
+  model.profile = &findControllerProfile(libevdev_get_id_vendor(dev),
+                                         libevdev_get_id_product(dev));
+  input_absinfo absinfo[AXIS_COUNT];
+  getAbsInfo(absinfo);
+  model = GamepadModel(absinfo, *model.profile);
+}
+
+Gamepad::Gamepad(Gamepad &&) = default;
+Gamepad &Gamepad::operator=(Gamepad &&) = default;
+Gamepad::~Gamepad() {}
+
+// Drains every pending event through the selected backend. Returns false
+// once the device has gone away; activity reports whether the controller
+// was used during this batch.
+bool Gamepad::updateState(bool &activity, RecordingWriter *recorder) {
+  inputTime = {};
+  bool alive = backend == InputBackend::Libevdev ? readLibevdev(recorder)
+                                                 : readRaw(recorder);
+  activity = finishBatch();
+  return alive;
+}
+
+// Called once a batch has been decoded: classifies activity and hands the
+// batch to the remapper, if any, in the same pass.
+bool Gamepad::finishBatch() {
+  if (remapper) {
+    remapper->flush(model, chrono::steady_clock::now());
+  }
+  return model.classify();
+}
+
+void Gamepad::apply(const input_event &ev) {
+  model.applyEvent(ev);
+  if (remapper) {
+    remapper->translate(ev, *model.profile);
+  }
+}
+
+// After a SYN_DROPPED libevdev hands out the delta between its cached state
+// and the device's real state in sync mode, which is applied like normal
+// input so nothing stays stuck.
+bool Gamepad::readLibevdev(RecordingWriter *recorder) {
+  struct input_event ev;
+  int rc = LIBEVDEV_READ_STATUS_SUCCESS;
+  uint64_t count = 0;
+  while (true) {
+    rc = libevdev_next_event(evdev.get(), LIBEVDEV_READ_FLAG_NORMAL, &ev);
+    if (rc == LIBEVDEV_READ_STATUS_SYNC) {
+      if (metrics) {
+        metrics->synDropped.add();
+      }
+      if (diagnostics) {
+        diagnostics->onDropped();
+      }
+      while (rc == LIBEVDEV_READ_STATUS_SYNC) {
+        if (recorder) {
+          recorder->writeEvent(id, ev);
+        }
+        apply(ev);
+        rc = libevdev_next_event(evdev.get(), LIBEVDEV_READ_FLAG_SYNC, &ev);
+      }
+      if (rc == -EAGAIN) {
+        continue;
+      }
+    }
+    if (rc != LIBEVDEV_READ_STATUS_SUCCESS) {
+      break;
+    }
+    if (count++ == 0) {
+      inputTime = eventTime(ev);
+    }
+    if (recorder) {
+      recorder->writeEvent(id, ev);
+    }
+    apply(ev);
+    if (diagnostics && ev.type == EV_SYN && ev.code == SYN_REPORT) {
+      diagnostics->onReport(eventTime(ev), model);
+    }
+  }
+  if (metrics) {
+    metrics->events.add(count);
+  }
+  return rc != -ENODEV;
+}
+
+// libevdev's cached state is not updated on this path, so after a
+// SYN_DROPPED everything up to the next SYN_REPORT is discarded, as the
+// evdev protocol requires, and the state is fetched from the kernel again.
+// A short read means the kernel queue was empty, which saves the final
+// read() that would only return EAGAIN.
+bool Gamepad::readRaw(RecordingWriter *recorder) {
+  static thread_local input_event buffer[RAW_BATCH_EVENTS];
+  int fd = this->fd();
+  while (true) {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno != ENODEV;
+    }
+    size_t count = length / sizeof(input_event);
+    decodeRaw(buffer, count, recorder);
+    if (count < RAW_BATCH_EVENTS) {
+      return true;
+    }
+  }
+}
+
+void Gamepad::decodeRaw(const input_event *events, size_t count,
+                        RecordingWriter *recorder) {
+  if (count > 0 && inputTime == chrono::steady_clock::time_point()) {
+    inputTime = eventTime(events[0]);
+  }
+  if (metrics) {
+    metrics->events.add(count);
+  }
+  for (size_t i = 0; i < count; i++) {
+    const input_event &ev = events[i];
+    if (recorder) {
+      recorder->writeEvent(id, ev);
+    }
+    if (ev.type == EV_SYN) {
+      if (ev.code == SYN_DROPPED) {
+        dropping = true;
+        if (metrics) {
+          metrics->synDropped.add();
+        }
+        if (diagnostics) {
+          diagnostics->onDropped();
+        }
+      } else if (ev.code == SYN_REPORT && dropping) {
+        dropping = false;
+        resync();
+        model.reports++;
+      } else if (ev.code == SYN_REPORT) {
+        model.reports++;
+        if (diagnostics) {
+          diagnostics->onReport(eventTime(ev), model);
+        }
+      }
+      continue;
+    }
+    if (!dropping) {
+      apply(ev);
+    }
+  }
+}
+
+// Everything the profile decodes is fetched again, so codes the controller
+// does not have are simply not found.
+void Gamepad::resync() {
+  int fd = this->fd();
+  const ControllerProfile &profile = *model.profile;
+  unsigned char keys[KEY_MAX / 8 + 1] = {};
+  if (ioctl(fd, EVIOCGKEY(sizeof(keys)), keys) >= 0) {
+    for (unsigned int i = 0; i < KEY_TABLE_SIZE; i++) {
+      if (profile.keys[i].kind != DecodeKind::Button) {
+        continue;
+      }
+      input_event ev = {};
+      ev.type = EV_KEY;
+      ev.code = KEY_TABLE_FIRST + i;
+      ev.value = (keys[ev.code / 8] >> (ev.code % 8)) & 1;
+      apply(ev);
+    }
+  }
+  for (unsigned int code = 0; code < ABS_CNT; code++) {
+    DecodeKind kind = profile.abs[code].kind;
+    if (kind != DecodeKind::Axis && kind != DecodeKind::Hat) {
+      continue;
+    }
+    input_absinfo info = {};
+    if (ioctl(fd, EVIOCGABS(code), &info) >= 0) {
+      input_event ev = {};
+      ev.type = EV_ABS;
+      ev.code = code;
+      ev.value = info.value;
+      apply(ev);
+    }
+  }
+}
+
+int Gamepad::fd() const { return libevdev_get_fd(evdev.get()); }
+
+// Only the buttons node has sticks and triggers; a touchpad's ABS_X and
+// ABS_Y are a finger position and stay unscaled. Ranges are read from the
+// code the profile decodes into each axis.
+void Gamepad::getAbsInfo(input_absinfo (&absinfo)[AXIS_COUNT]) const {
+  for (unsigned int slot = 0; slot < AXIS_COUNT; slot++) {
+    uint16_t code = model.profile->axisCodes[slot];
+    if (role != NodeRole::Buttons || code == NO_AXIS) {
+      absinfo[slot] = input_absinfo{};
+      continue;
+    }
+    const input_absinfo *info = libevdev_get_abs_info(evdev.get(), code);
+    absinfo[slot] = info ? *info : input_absinfo{};
+  }
+}
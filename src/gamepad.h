@@ -0,0 +1,151 @@
+#pragma once
+
+#include "controller_profile.h"
+#include <chrono>
+#include <cstdint>
+#include <libevdev-1.0/libevdev/libevdev.h>
+#include <linux/input.h>
+#include <memory>
+#include <string>
+
+class RecordingWriter;
+class Remapper;
+struct DeviceDiagnostics;
+struct DeviceMetrics;
+struct PhysicalController;
+
+// Everything the activity checks read, packed into a single cache line.
+// Buttons BTN_A..BTN_THUMBR and the D-pad map to bits of the mask. Axes
+// are indexed by the ABS code of the standard layout (ABS_X..ABS_RZ),
+// whatever code the controller's profile reads them from, normalised to
+// -1..1 for sticks and 0..1 for triggers.
+struct alignas(64) GamepadState {
+  uint64_t buttons = 0;
+  float axes[AXIS_COUNT] = {};
+};
+
+static_assert(sizeof(GamepadState) == 64, "GamepadState must fit a cache line");
+static_assert(DPAD_BIT + 4 <= 64, "buttons must fit the mask");
+
+// Activity is judged per control group: the left stick, the right stick
+// and each trigger. A group turns active once its displacement from the
+// calibrated centre passes the enter radius and only turns inactive again
+// below the smaller exit radius. While a group sits inside the enter radius
+// its centre creeps towards the reading by DRIFT_RATE of the distance per
+// report, bounded by MAX_DRIFT, so a worn stick that settles off-centre
+// goes quiet. The rate is far below any deliberate motion, so a slow sweep
+// barely moves the centre.
+#define GROUP_COUNT 4
+
+static constexpr float STICK_ENTER_RADIUS = 0.20f;
+static constexpr float STICK_EXIT_RADIUS = 0.12f;
+static constexpr float TRIGGER_ENTER_RADIUS = 0.10f;
+static constexpr float TRIGGER_EXIT_RADIUS = 0.05f;
+static constexpr float DRIFT_RATE = 1.0f / 512.0f;
+static constexpr float MAX_DRIFT = 0.25f;
+
+struct AxisScale {
+  float scale = 0.0f;
+  float offset = 0.0f;
+};
+
+// Decodes input events into GamepadState through the controller's profile
+// and classifies activity. It has no device behind it, so the daemon and
+// the replay benchmark run the exact same code.
+class GamepadModel {
+public:
+  GamepadModel() = default;
+  explicit GamepadModel(
+      const input_absinfo (&absinfo)[AXIS_COUNT],
+      const ControllerProfile &profile = genericControllerProfile);
+  void applyEvent(const input_event &ev);
+  bool classify();
+  bool isAnyButtonPressed() const { return state.buttons != 0; }
+  bool isAxisMoved() const { return activeGroups & 0b0011; }
+  bool isAnyTriggerPressed() const { return activeGroups & 0b1100; }
+  bool isActive() const { return state.buttons != 0 || activeGroups != 0; }
+
+  GamepadState state;
+  const ControllerProfile *profile = &genericControllerProfile;
+  AxisScale axisScales[AXIS_COUNT];
+  float centre[AXIS_COUNT] = {};
+  uint32_t activeGroups = 0;
+  // SYN_REPORTs applied since the last classify(), which scale the drift.
+  uint32_t reports = 0;
+  bool pressed = false;
+
+private:
+  void setButton(unsigned int bit, bool down);
+};
+
+// What an event node contributes to its physical controller. Pads such
+// as the DualSense expose buttons and sticks, the touchpad and the IMU as
+// separate nodes. A touchpad counts as activity while it is touched; its
+// absolute position is never read as a stick.
+enum class NodeRole : uint8_t { Buttons, Touchpad, Motion };
+
+// How a Gamepad pulls events from its fd. Libevdev goes through
+// libevdev_next_event() one event at a time; Raw read()s up to
+// RAW_BATCH_EVENTS input_events per syscall and decodes them in a tight
+// loop, keeping libevdev only for probing the device. IoUring leaves the
+// reading to DeviceRegistry's UringReader and decodes like Raw.
+enum class InputBackend { Libevdev, Raw, IoUring };
+
+#define RAW_BATCH_EVENTS 64
+
+// Controllers are switched to CLOCK_MONOTONIC at open, so event timestamps
+// share steady_clock's epoch.
+inline std::chrono::steady_clock::time_point eventTime(const input_event &ev) {
+  return std::chrono::steady_clock::time_point(
+      std::chrono::seconds(ev.input_event_sec) +
+      std::chrono::microseconds(ev.input_event_usec));
+}
+
+class Gamepad {
+public:
+  Gamepad(const std::string &path, InputBackend backend = InputBackend::Libevdev,
+          NodeRole role = NodeRole::Buttons);
+  Gamepad(Gamepad &&);
+  Gamepad &operator=(Gamepad &&);
+  ~Gamepad();
+  bool updateState(bool &activity, RecordingWriter *recorder = nullptr);
+  bool finishBatch();
+  bool isAnyButtonPressed() const { return model.isAnyButtonPressed(); }
+  bool isAxisMoved() const { return model.isAxisMoved(); }
+  bool isAnyTriggerPressed() const { return model.isAnyTriggerPressed(); }
+  bool isActive() const { return model.isActive(); }
+  int fd() const;
+  void getAbsInfo(input_absinfo (&absinfo)[AXIS_COUNT]) const;
+  void decodeRaw(const input_event *events, size_t count,
+                 RecordingWriter *recorder);
+
+  std::string path;
+  InputBackend backend;
+  NodeRole role;
+  uint16_t id = 0;
+  // Index of the seat the controller counts for, see
+  // DeviceRegistry::setSeats().
+  uint8_t seat = 0;
+  bool active = false;
+  bool dropping = false;
+  // Kernel timestamp of the first event of the latest batch, or zero if
+  // the batch was empty.
+  std::chrono::steady_clock::time_point inputTime;
+  DeviceMetrics *metrics = nullptr;
+  // Set by --diagnose, which times every report.
+  DeviceDiagnostics *diagnostics = nullptr;
+  PhysicalController *controller = nullptr;
+  // Slot in the shared state region, or -1.
+  int snapshotSlot = -1;
+  std::unique_ptr<libevdev, void (*)(libevdev *)> evdev;
+  GamepadModel model;
+  // Set while the controller is grabbed and translated to keyboard and
+  // mouse input.
+  std::unique_ptr<Remapper> remapper;
+
+private:
+  void apply(const input_event &ev);
+  bool readLibevdev(RecordingWriter *recorder);
+  bool readRaw(RecordingWriter *recorder);
+  void resync();
+};
@@ -0,0 +1,58 @@
+#include "inhibit_backend.h"
+#include <iostream>
+
+using namespace std;
+
+bool WaylandInhibitBackend::prepare() { return prepareWaylandRead(context); }
+
+bool WaylandInhibitBackend::dispatch(bool readable) {
+  return dispatchWayland(context, readable);
+}
+
+void WaylandInhibitBackend::inhibit() {
+  context.idle_inhibitor = zwp_idle_inhibit_manager_v1_create_inhibitor(
+      context.idle_inhibit_manager, context.surface);
+  wl_surface_commit(context.surface);
+}
+
+void WaylandInhibitBackend::uninhibit() {
+  zwp_idle_inhibitor_v1_destroy(context.idle_inhibitor);
+  wl_surface_commit(context.surface);
+  context.idle_inhibitor = nullptr;
+}
+
+bool resolveInhibitMethod(InhibitMethod &method) {
+  if (method == InhibitMethod::Wayland) {
+    return true;
+  }
+  unique_ptr<DBusInhibitBackend> probe = DBusInhibitBackend::create();
+  if (probe && probe->waitForService()) {
+    method = InhibitMethod::DBus;
+    return true;
+  }
+  if (method == InhibitMethod::DBus) {
+    cerr << "org.freedesktop.ScreenSaver is not available on the session bus"
+         << endl;
+    return false;
+  }
+  method = InhibitMethod::Wayland;
+  return true;
+}
+
+unique_ptr<InhibitBackend> openInhibitBackend(InhibitMethod method,
+                                              wlContext &context) {
+  if (method == InhibitMethod::Auto) {
+    resolveInhibitMethod(method);
+  }
+  if (method == InhibitMethod::DBus) {
+    unique_ptr<InhibitBackend> backend = DBusInhibitBackend::create();
+    if (!backend) {
+      cerr << "Failed to connect to the session bus" << endl;
+    }
+    return backend;
+  }
+  if (!connectToWayland(context)) {
+    return nullptr;
+  }
+  return make_unique<WaylandInhibitBackend>(context);
+}
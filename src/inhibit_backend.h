@@ -0,0 +1,103 @@
+#pragma once
+
+#include "wayland.h"
+#include <cstdint>
+#include <memory>
+
+struct DBusConnection;
+struct DBusPendingCall;
+
+// How the idle inhibitor reaches the desktop. Nothing here may block the
+// event loop: inhibit() and uninhibit() only queue requests, prepare()
+// sends what is queued right before the loop sleeps, and dispatch()
+// handles whatever arrived on fd() after it wakes up.
+class InhibitBackend {
+public:
+  virtual ~InhibitBackend() = default;
+  virtual const char *name() const = 0;
+  virtual int fd() const = 0;
+  // Both return false once the connection is lost.
+  virtual bool prepare() = 0;
+  virtual bool dispatch(bool readable) = 0;
+  virtual void inhibit() = 0;
+  virtual void uninhibit() = 0;
+  // Messages one inhibit() or uninhibit() puts on the wire.
+  virtual unsigned int messagesPerTransition() const = 0;
+};
+
+enum class InhibitMethod { Auto, Wayland, DBus };
+
+// zwp_idle_inhibit_manager_v1 on a surface that is never mapped. sway and
+// other wlroots compositors honour that; KWin only honours inhibitors on
+// visible surfaces. context must already be connected and outlive the
+// backend.
+class WaylandInhibitBackend : public InhibitBackend {
+public:
+  explicit WaylandInhibitBackend(wlContext &context) : context(context) {}
+  const char *name() const override { return "wayland"; }
+  int fd() const override { return wl_display_get_fd(context.display); }
+  bool prepare() override;
+  bool dispatch(bool readable) override;
+  void inhibit() override;
+  void uninhibit() override;
+  unsigned int messagesPerTransition() const override { return 2; }
+
+private:
+  wlContext &context;
+};
+
+// org.freedesktop.ScreenSaver Inhibit/UnInhibit on the session bus, which
+// KDE Plasma and most desktop environments implement. Calls are sent
+// without waiting; the cookie from Inhibit is picked up from the reply in
+// dispatch(), and an UnInhibit requested before it arrived is sent as soon
+// as it does. create() only connects to the bus and queues the check for
+// the service, so it is safe to call from the event loop; an inhibit
+// requested before the answer is held back until then, and prepare() and
+// dispatch() fail if nothing owns the service. create() returns nullptr
+// when waypad was built without libdbus or the session bus is unreachable.
+class DBusInhibitBackend : public InhibitBackend {
+public:
+  static std::unique_ptr<DBusInhibitBackend> create();
+  ~DBusInhibitBackend();
+  const char *name() const override { return "dbus"; }
+  int fd() const override { return busFd; }
+  bool prepare() override;
+  bool dispatch(bool readable) override;
+  void inhibit() override;
+  void uninhibit() override;
+  unsigned int messagesPerTransition() const override { return 1; }
+  // Blocks until the bus says whether the service has an owner.
+  bool waitForService();
+  void onOwnerReply(bool ok, bool hasOwner);
+  void onInhibitReply(bool ok, uint32_t cookie);
+
+private:
+  explicit DBusInhibitBackend(DBusConnection *connection);
+  void sendInhibit();
+  void sendUnInhibit();
+
+  DBusConnection *connection;
+  // Kept so the destructor can settle or cancel them; their notify
+  // functions point back at this backend.
+  DBusPendingCall *ownerCall = nullptr;
+  DBusPendingCall *inhibitCall = nullptr;
+  int busFd = -1;
+  uint32_t cookie = 0;
+  bool serviceKnown = false;
+  bool serviceMissing = false;
+  bool inhibitHeld = false;
+  bool haveCookie = false;
+  bool releaseWanted = false;
+};
+
+// Settles Auto, and checks that DBus is usable, by asking the session bus
+// whether org.freedesktop.ScreenSaver has an owner. That waits for the
+// bus, so it is done once before the event loop starts and the method it
+// leaves behind is what openInhibitBackend() gets from then on. Returns
+// false after reporting why if DBus was asked for and is unavailable.
+bool resolveInhibitMethod(InhibitMethod &method);
+
+// Opens the backend for method, connecting context for Wayland. Returns
+// nullptr after reporting why if it is unavailable.
+std::unique_ptr<InhibitBackend> openInhibitBackend(InhibitMethod method,
+                                                   wlContext &context);
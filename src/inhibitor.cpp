@@ -0,0 +1,170 @@
+#include "inhibitor.h"
+#include "metrics.h"
+#include "status_log.h"
+#include <algorithm>
+
+using namespace std;
+
+// Messages one create or one destroy costs on the Wayland protocol, the
+// request plus its wl_surface_commit. That is the most expensive backend,
+// and avoided requests are counted in its units whatever backend is in
+// use.
+#define MESSAGES_PER_TRANSITION 2
+
+Inhibitor::Inhibitor(InhibitBackend *backend, const InhibitConfig &config,
+                     Clock::time_point now)
+    : backend(backend), config(config), seatIdle(!config.waitForSeatIdle),
+      firstActivity(now),
+      lastActivity(now), firstInput(now), lastChange(now) {}
+
+// inputTime is the kernel timestamp of the input behind this activity and
+// only feeds the latency metrics.
+void Inhibitor::onActivity(Clock::time_point now, Clock::time_point inputTime) {
+  switch (state) {
+  case State::Idle:
+    report("controller is active");
+    announced = true;
+    firstActivity = now;
+    firstInput = min(inputTime, now);
+    state = State::Pending;
+    break;
+  case State::Lingering:
+    report("controller is active");
+    // Resuming inside the grace period saves a destroy and a create.
+    counters.requestsAvoided += 2 * MESSAGES_PER_TRANSITION;
+    publishStats();
+    state = State::Active;
+    break;
+  default:
+    break;
+  }
+  lastActivity = now;
+  update(now);
+}
+
+void Inhibitor::update(Clock::time_point now) {
+  auto inactive = now - lastActivity;
+  // Several transitions can fall due at once, e.g. Active straight to Idle
+  // without a release grace, so keep going until the state settles.
+  State previous;
+  do {
+    previous = state;
+    switch (state) {
+    case State::Idle:
+      if (!announced && inactive >= config.idleTimeout) {
+        report("controller is inactive");
+        announced = true;
+      }
+      break;
+    case State::Pending:
+      if (lastActivity - firstActivity >= config.activationDelay) {
+        state = State::Active;
+      } else if (inactive >= pendingWindow()) {
+        report("controller is inactive");
+        // The burst ended before it was worth inhibiting.
+        counters.requestsAvoided += 2 * MESSAGES_PER_TRANSITION;
+        publishStats();
+        state = State::Idle;
+      }
+      break;
+    case State::Active:
+      if (inactive >= config.idleTimeout) {
+        report("controller is inactive");
+        state = State::Lingering;
+      }
+      break;
+    case State::Lingering:
+      if (inactive >= config.idleTimeout + config.releaseGrace) {
+        state = State::Idle;
+      }
+      break;
+    }
+  } while (state != previous);
+  wantInhibit = state == State::Active || state == State::Lingering;
+}
+
+// The desktop went away and took any inhibitor with it. Whatever is still
+// wanted is requested again once setBackend() provides a new connection.
+void Inhibitor::dropBackend() {
+  backend = nullptr;
+  inhibiting = false;
+  publishStats();
+}
+
+// An inhibitor that exists is kept until the controller goes idle even if
+// the seat resumes, since that is also what a version 1 idle notification
+// reports as soon as the inhibitor is created.
+bool Inhibitor::flush() {
+  bool desired = wantInhibit && (seatIdle || inhibiting);
+  if (wantInhibit && !desired) {
+    heldBack = true;
+  } else if (!wantInhibit && heldBack && !inhibiting) {
+    // Play ended while the seat was still in use.
+    heldBack = false;
+    counters.requestsAvoided += 2 * MESSAGES_PER_TRANSITION;
+    publishStats();
+  }
+  if (!backend || desired == inhibiting) {
+    return false;
+  }
+  auto now = Clock::now();
+  if (metrics) {
+    (wantInhibit ? metrics->offDuration : metrics->onDuration)
+        .observe(now - lastChange);
+    // Time spent waiting for the seat to idle is not latency.
+    if (wantInhibit && !heldBack) {
+      metrics->requestLatency.observe(now - firstInput);
+    }
+  }
+  lastChange = now;
+  if (wantInhibit) {
+    backend->inhibit();
+    heldBack = false;
+    counters.inhibits++;
+    report("Idle inhibitor created successfully");
+  } else {
+    backend->uninhibit();
+    report("Idle inhibitor destroyed successfully");
+  }
+  inhibiting = wantInhibit;
+  counters.requestsSent += backend->messagesPerTransition();
+  publishStats();
+  return true;
+}
+
+void Inhibitor::report(const char *message) const {
+  if (config.log) {
+    logStatus(message, config.seat);
+  }
+}
+
+void Inhibitor::publishStats() {
+  if (metrics) {
+    metrics->requestsSent.set(counters.requestsSent);
+    metrics->requestsAvoided.set(counters.requestsAvoided);
+    metrics->inhibiting.set(isInhibiting());
+  }
+}
+
+// A pending burst is dropped once input has paused for a whole activation
+// delay, or the idle timeout if that is shorter.
+Inhibitor::Clock::duration Inhibitor::pendingWindow() const {
+  return min(config.activationDelay, config.idleTimeout);
+}
+
+// The next moment update() could change something without new input.
+Inhibitor::Clock::time_point Inhibitor::deadline() const {
+  switch (state) {
+  case State::Idle:
+    return announced ? Clock::time_point::max()
+                     : lastActivity + config.idleTimeout;
+  case State::Pending:
+    // Activation is decided on input, so only the expiry is a deadline.
+    return lastActivity + pendingWindow();
+  case State::Active:
+    return lastActivity + config.idleTimeout;
+  case State::Lingering:
+    return lastActivity + config.idleTimeout + config.releaseGrace;
+  }
+  return Clock::time_point::max();
+}
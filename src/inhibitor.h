@@ -0,0 +1,82 @@
+#pragma once
+
+#include "inhibit_backend.h"
+#include <chrono>
+#include <cstdint>
+
+struct InhibitorMetrics;
+
+struct InhibitConfig {
+  // How long after the last controller input the controller counts as
+  // inactive.
+  std::chrono::steady_clock::duration idleTimeout = std::chrono::seconds(10);
+  // Input has to keep arriving for this long before an inhibitor is
+  // requested, so a bumped controller causes no protocol traffic.
+  std::chrono::steady_clock::duration activationDelay{0};
+  // The inhibitor is kept this long past idleTimeout, so a short pause in
+  // play does not destroy and recreate it.
+  std::chrono::steady_clock::duration releaseGrace{0};
+  // Only create the inhibitor while the compositor reports the seat idle
+  // (see setSeatIdle()), so ordinary keyboard and mouse use keeps the
+  // session awake on its own and costs no requests.
+  bool waitForSeatIdle = false;
+  // Log state changes to the status log, naming the seat if set.
+  bool log = true;
+  const char *seat = nullptr;
+};
+
+struct InhibitStats {
+  uint64_t requestsSent = 0;
+  uint64_t requestsAvoided = 0;
+  uint64_t inhibits = 0;
+};
+
+// Decides when the idle inhibitor should exist. Input only updates the
+// desired state; flush() hands the change to the backend once per loop
+// iteration, and only if the desired state differs from what the desktop
+// already has, so flapping within an iteration or a grace period never
+// reaches the wire.
+class Inhibitor {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // backend may be null until the desktop is connected; flush() then
+  // holds the desired state until setBackend().
+  Inhibitor(InhibitBackend *backend, const InhibitConfig &config,
+            Clock::time_point now);
+  void setBackend(InhibitBackend *backend) { this->backend = backend; }
+  void dropBackend();
+  void setSeatIdle(bool idle) { seatIdle = idle; }
+  void onActivity(Clock::time_point now, Clock::time_point inputTime);
+  void update(Clock::time_point now);
+  bool flush();
+  Clock::time_point deadline() const;
+  bool isControllerActive() const { return state != State::Idle; }
+  bool isInhibiting() const { return inhibiting; }
+  bool wantsInhibitor() const { return wantInhibit; }
+  const InhibitStats &stats() const { return counters; }
+  void setMetrics(InhibitorMetrics *metrics) { this->metrics = metrics; }
+
+private:
+  enum class State { Idle, Pending, Active, Lingering };
+
+  Clock::duration pendingWindow() const;
+  void report(const char *message) const;
+  void publishStats();
+
+  InhibitBackend *backend;
+  InhibitConfig config;
+  State state = State::Idle;
+  bool announced = false;
+  bool wantInhibit = false;
+  bool inhibiting = false;
+  bool seatIdle;
+  // The controller wanted an inhibitor that the seat did not need yet.
+  bool heldBack = false;
+  Clock::time_point firstActivity;
+  Clock::time_point lastActivity;
+  Clock::time_point firstInput;
+  Clock::time_point lastChange;
+  InhibitStats counters;
+  InhibitorMetrics *metrics = nullptr;
+};
@@ -0,0 +1,161 @@
+#include "input_thread.h"
+#include "event_loop.h"
+#include "metrics.h"
+#include "recording.h"
+#include "status_log.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <pthread.h>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+using namespace std;
+
+#define INPUT_THREAD_PRIORITY 10
+
+InputThread::InputThread() {
+  epollFd = epoll_create1(EPOLL_CLOEXEC);
+  wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (epollFd == -1 || wakeFd == -1 || stopFd == -1) {
+    throw runtime_error("Failed to create input thread: " +
+                        string(strerror(errno)));
+  }
+  if (!addToEpoll(epollFd, stopFd, epollTag(EventSource::Input))) {
+    throw runtime_error("Failed to register fd with epoll: " +
+                        string(strerror(errno)));
+  }
+  registry = make_unique<DeviceRegistry>(epollFd);
+}
+
+InputThread::~InputThread() {
+  stop();
+  registry.reset();
+  close(stopFd);
+  close(wakeFd);
+  close(epollFd);
+}
+
+// Opens the controllers on the calling thread so the caller knows how many
+// were found, then hands the registry over to the input thread for good.
+size_t InputThread::start(const filesystem::path &inputFolder,
+                          RecordingWriter *recorder, InputBackend backend,
+                          bool realtime) {
+  this->recorder = recorder;
+  registry->setRecorder(recorder);
+  registry->setBackend(backend);
+  if (!registry->watch(inputFolder)) {
+    cerr << "Failed to watch for controller hotplug: " << strerror(errno)
+         << endl;
+    registry->scan(inputFolder);
+  }
+  for (const string &path : extraDevices) {
+    if (!registry->contains(path)) {
+      registry->add(path);
+    }
+  }
+  size_t count = registry->size();
+  devices.store(count, memory_order_release);
+
+  thread = std::thread(&InputThread::run, this);
+  if (realtime) {
+    struct sched_param param = {};
+    param.sched_priority = INPUT_THREAD_PRIORITY;
+    int rc = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+    if (rc != 0) {
+      cerr << "Failed to make input thread realtime: " << strerror(rc)
+           << endl;
+    }
+  }
+  return count;
+}
+
+// Must be called before start().
+void InputThread::setMetrics(Metrics *metrics) {
+  this->metrics = metrics;
+  registry->setMetrics(metrics);
+}
+
+void InputThread::stop() {
+  if (!thread.joinable()) {
+    return;
+  }
+  uint64_t one = 1;
+  if (write(stopFd, &one, sizeof(one)) != sizeof(one)) {
+    cerr << "Failed to stop input thread: " << strerror(errno) << endl;
+  }
+  thread.join();
+}
+
+void InputThread::run() {
+  while (true) {
+    struct epoll_event events[32];
+    int count = epoll_wait(epollFd, events, 32, -1);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "epoll_wait failed on input thread: " << strerror(errno)
+           << endl;
+      return;
+    }
+    if (metrics) {
+      metrics->inputWakeups.add();
+    }
+
+    for (int i = 0; i < count; i++) {
+      if (epollSource(events[i].data.u64) == EventSource::Input) {
+        return;
+      }
+      registry->handleEpollEvent(events[i].data.u64);
+    }
+    registry->reap();
+    if (recorder) {
+      recorder->flush();
+    }
+    flushStatusLog();
+    if (registry->size() != devices.load(memory_order_relaxed)) {
+      devices.store(registry->size(), memory_order_release);
+      wake();
+    }
+
+    // A tap that started and ended within this batch still has to reach
+    // the Wayland thread as a rising edge.
+    auto now = chrono::steady_clock::now();
+    for (size_t seat = 0; seat < registry->seatCount(); seat++) {
+      auto activityTime = registry->takeActivityTime(seat);
+      bool activity = activityTime != chrono::steady_clock::time_point::max();
+      auto inputTime = min(activityTime, now);
+      if (activity && !published[seat]) {
+        publish(seat, true, inputTime);
+      }
+      bool active = registry->isActive(seat);
+      if (active != published[seat] || pending[seat]) {
+        publish(seat, active, active ? inputTime : now);
+      }
+    }
+  }
+}
+
+// If the ring is full the edge stays pending and is retried after the next
+// batch; the consumer only cares about the latest state, so nothing is lost.
+void InputThread::publish(size_t seat, bool active,
+                          chrono::steady_clock::time_point time) {
+  if (!ring.push(ActivityEdge{active, time, static_cast<uint8_t>(seat)})) {
+    pending[seat] = true;
+    return;
+  }
+  pending[seat] = false;
+  published[seat] = active;
+  wake();
+}
+
+void InputThread::wake() {
+  uint64_t one = 1;
+  if (write(wakeFd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN) {
+    cerr << "Failed to wake Wayland thread: " << strerror(errno) << endl;
+  }
+}
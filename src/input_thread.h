@@ -0,0 +1,73 @@
+#pragma once
+
+#include "device_registry.h"
+#include "spsc_ring.h"
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Metrics;
+class RecordingWriter;
+
+// A change in whether any controller is active, as seen by the input
+// thread. Only edges are published: while controllers stay active the
+// consumer keeps treating them as active until the falling edge arrives.
+// Rising edges carry the kernel timestamp of the input behind them. Each
+// seat has edges of its own.
+struct ActivityEdge {
+  bool active;
+  std::chrono::steady_clock::time_point time;
+  uint8_t seat = 0;
+};
+
+// Reads every controller on its own thread so that a stalled compositor
+// connection cannot delay draining the evdev buffers. Activity edges are
+// handed to the Wayland thread through a wait-free ring, and notifyFd()
+// becomes readable whenever new edges are queued.
+class InputThread {
+public:
+  InputThread();
+  ~InputThread();
+  size_t start(const std::filesystem::path &inputFolder,
+               RecordingWriter *recorder, InputBackend backend, bool realtime);
+  void stop();
+  void setMetrics(Metrics *metrics);
+  bool setRemap(const RemapTable *table) { return registry->setRemap(table); }
+  bool setMotionRate(double hz) { return registry->setMotionRate(hz); }
+  void setSnapshot(StateSnapshot *snapshot) { registry->setSnapshot(snapshot); }
+  void setSeats(const std::vector<std::string> &names) {
+    registry->setSeats(names);
+  }
+  // Opened by start() in addition to whatever discovery finds.
+  void addDevice(const std::string &path) { extraDevices.push_back(path); }
+  int notifyFd() const { return wakeFd; }
+  bool pop(ActivityEdge &edge) { return ring.pop(edge); }
+  // Open devices as of the input thread's latest batch; changes also wake
+  // notifyFd().
+  size_t deviceCount() const {
+    return devices.load(std::memory_order_acquire);
+  }
+
+private:
+  void run();
+  void publish(size_t seat, bool active,
+               std::chrono::steady_clock::time_point time);
+  void wake();
+
+  int epollFd = -1;
+  int wakeFd = -1;
+  int stopFd = -1;
+  std::unique_ptr<DeviceRegistry> registry;
+  RecordingWriter *recorder = nullptr;
+  Metrics *metrics = nullptr;
+  std::vector<std::string> extraDevices;
+  SpscRing<ActivityEdge, 64> ring;
+  bool published[MAX_SEATS] = {};
+  bool pending[MAX_SEATS] = {};
+  std::atomic<size_t> devices{0};
+  std::thread thread;
+};
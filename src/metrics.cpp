@@ -0,0 +1,283 @@
+#include "metrics.h"
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+void Histogram::observe(chrono::nanoseconds value) {
+  unsigned int index = 0;
+  if (value > base) {
+    uint64_t units = (value.count() + base.count() - 1) / base.count();
+    index = 64 - __builtin_clzll(units - 1);
+  }
+  buckets[index < HISTOGRAM_BUCKETS ? index : HISTOGRAM_BUCKETS].add();
+  sum.add(value.count() > 0 ? value.count() : 0);
+}
+
+void Histogram::write(MetricsText &out, const char *name,
+                      const char *labels) const {
+  const char *comma = labels[0] ? "," : "";
+  uint64_t cumulative = 0;
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    cumulative += buckets[i].load();
+    double bound = chrono::duration<double>(base).count() * (uint64_t(1) << i);
+    out.append("%s_bucket{%s%sle=\"%.12g\"} %" PRIu64 "\n", name, labels,
+               comma, bound, cumulative);
+  }
+  cumulative += buckets[HISTOGRAM_BUCKETS].load();
+  out.append("%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n", name, labels, comma,
+             cumulative);
+  const char *open = labels[0] ? "{" : "";
+  const char *close = labels[0] ? "}" : "";
+  out.append("%s_sum%s%s%s %.12g\n", name, open, labels, close,
+             sum.load() / 1e9);
+  out.append("%s_count%s%s%s %" PRIu64 "\n", name, open, labels, close,
+             cumulative);
+}
+
+void MetricsText::append(const char *format, ...) {
+  if (overflow) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buffer.get() + length, capacity - length, format,
+                          args);
+  va_end(args);
+  if (written < 0 || static_cast<size_t>(written) >= capacity - length) {
+    overflow = true;
+    return;
+  }
+  length += written;
+}
+
+DeviceMetrics *Metrics::addDevice(const string &path) {
+  lock_guard<mutex> lock(devicesLock);
+  devices.emplace_back(path);
+  return &devices.back();
+}
+
+void Metrics::removeDevice(DeviceMetrics *device) {
+  lock_guard<mutex> lock(devicesLock);
+  devices.remove_if(
+      [device](const DeviceMetrics &entry) { return &entry == device; });
+}
+
+InhibitorMetrics *Metrics::addSeat(const string &seat) {
+  seats.emplace_back();
+  seats.back().seat = seat;
+  return &seats.back();
+}
+
+static void header(MetricsText &out, const char *name, const char *type,
+                   const char *help) {
+  out.append("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// Labels are formatted into this, so no label is ever longer.
+#define METRICS_LABEL_SIZE 256
+
+static void seatLabel(char (&label)[METRICS_LABEL_SIZE],
+                      const InhibitorMetrics &entry) {
+  label[0] = '\0';
+  if (!entry.seat.empty()) {
+    snprintf(label, sizeof(label), "seat=\"%s\"", entry.seat.c_str());
+  }
+}
+
+// Prometheus text exposition format, version 0.0.4. The unlabelled
+// inhibitor stands in for the seats when there are none.
+bool Metrics::render() {
+  MetricsText &out = output;
+  out.clear();
+  header(out, "waypad_loop_wakeups_total", "counter",
+         "Event loop wakeups per thread.");
+  out.append("waypad_loop_wakeups_total{thread=\"main\"} %" PRIu64 "\n",
+             mainWakeups.load());
+  out.append("waypad_loop_wakeups_total{thread=\"input\"} %" PRIu64 "\n",
+             inputWakeups.load());
+
+  char label[METRICS_LABEL_SIZE];
+  auto forEachInhibitor = [&](auto write) {
+    if (seats.empty()) {
+      seatLabel(label, inhibitor);
+      write(inhibitor);
+    }
+    for (const InhibitorMetrics &seat : seats) {
+      seatLabel(label, seat);
+      write(seat);
+    }
+  };
+  auto counter = [&](const char *name, const char *type, const char *help,
+                     const Counter InhibitorMetrics::*field) {
+    header(out, name, type, help);
+    forEachInhibitor([&](const InhibitorMetrics &entry) {
+      if (label[0]) {
+        out.append("%s{%s} %" PRIu64 "\n", name, label,
+                   (entry.*field).load());
+      } else {
+        out.append("%s %" PRIu64 "\n", name, (entry.*field).load());
+      }
+    });
+  };
+  auto histogram = [&](const char *name, const char *help,
+                       const Histogram InhibitorMetrics::*field) {
+    header(out, name, "histogram", help);
+    forEachInhibitor([&](const InhibitorMetrics &entry) {
+      (entry.*field).write(out, name, label);
+    });
+  };
+  counter("waypad_inhibitor_active", "gauge",
+          "Whether an idle inhibitor currently exists.",
+          &InhibitorMetrics::inhibiting);
+  counter("waypad_inhibitor_requests_total", "counter",
+          "Inhibitor messages sent to the inhibit backend.",
+          &InhibitorMetrics::requestsSent);
+  counter("waypad_inhibitor_requests_avoided_total", "counter",
+          "Inhibitor messages avoided by debouncing (counted in Wayland "
+          "request units).",
+          &InhibitorMetrics::requestsAvoided);
+  histogram("waypad_inhibitor_request_latency_seconds",
+            "Kernel input timestamp to inhibitor create request.",
+            &InhibitorMetrics::requestLatency);
+  histogram("waypad_inhibitor_on_seconds",
+            "How long each idle inhibitor was held.",
+            &InhibitorMetrics::onDuration);
+  histogram("waypad_inhibitor_off_seconds",
+            "How long the session went without an idle inhibitor.",
+            &InhibitorMetrics::offDuration);
+
+  lock_guard<mutex> lock(devicesLock);
+  auto deviceCounter = [&](const char *name, const char *help,
+                           const Counter DeviceMetrics::*field) {
+    header(out, name, "counter", help);
+    for (const DeviceMetrics &device : devices) {
+      out.append("%s{device=\"%s\"} %" PRIu64 "\n", name, device.path.c_str(),
+                 (device.*field).load());
+    }
+  };
+  deviceCounter("waypad_device_events_total",
+                "Input events read per controller.", &DeviceMetrics::events);
+  deviceCounter("waypad_device_syn_dropped_total",
+                "Kernel buffer overruns (SYN_DROPPED) per controller.",
+                &DeviceMetrics::synDropped);
+  deviceCounter("waypad_device_active_batches_total",
+                "Read batches that showed controller activity.",
+                &DeviceMetrics::activeBatches);
+  header(out, "waypad_device_detection_latency_seconds", "histogram",
+         "Kernel input timestamp to the activity decision.");
+  for (const DeviceMetrics &device : devices) {
+    snprintf(label, sizeof(label), "device=\"%s\"", device.path.c_str());
+    device.detectionLatency.write(
+        out, "waypad_device_detection_latency_seconds", label);
+  }
+  return !out.truncated();
+}
+
+// Written next to the target and renamed over it, so a collector such as
+// node_exporter's textfile module never sees a partial file. Straight
+// syscalls, so a write on the timer allocates nothing.
+bool Metrics::writeFile(const string &path) {
+  char temporary[PATH_MAX];
+  if (snprintf(temporary, sizeof(temporary), "%s.tmp", path.c_str()) >=
+          static_cast<int>(sizeof(temporary)) ||
+      !render()) {
+    return false;
+  }
+  int fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  size_t written = 0;
+  while (written < output.size()) {
+    ssize_t n = write(fd, output.data() + written, output.size() - written);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break;
+    }
+    written += n;
+  }
+  if (close(fd) != 0 || written < output.size()) {
+    unlink(temporary);
+    return false;
+  }
+  return rename(temporary, path.c_str()) == 0;
+}
+
+MetricsSocket::~MetricsSocket() {
+  if (listenFd != -1) {
+    close(listenFd);
+    unlink(path.c_str());
+  }
+}
+
+bool MetricsSocket::open(const string &path) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    errno = ENAMETOOLONG;
+    return false;
+  }
+  strcpy(address.sun_path, path.c_str());
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listenFd == -1) {
+    return false;
+  }
+  unlink(path.c_str());
+  if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) == -1 ||
+      listen(listenFd, 8) == -1) {
+    close(listenFd);
+    listenFd = -1;
+    return false;
+  }
+  this->path = path;
+  return true;
+}
+
+// This runs on the main loop, so a client that does not read is never
+// waited for. With a handful of controllers the text is a few kilobytes
+// and fits the socket buffer in one send(); whatever does not fit at once
+// is dropped and the reader sees a short response.
+void MetricsSocket::serve(Metrics &metrics) {
+  // Clients accepted in one wakeup all get the same rendering.
+  bool rendered = false;
+  while (true) {
+    int client =
+        accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client == -1) {
+      if (errno != EAGAIN && errno != EINTR) {
+        cerr << "Failed to accept metrics connection: " << strerror(errno)
+             << endl;
+      }
+      return;
+    }
+    if (!rendered) {
+      metrics.render();
+      rendered = true;
+    }
+    const MetricsText &body = metrics.text();
+    size_t sent = 0;
+    while (sent < body.size()) {
+      ssize_t n =
+          send(client, body.data() + sent, body.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        break;
+      }
+      sent += n;
+    }
+    close(client);
+  }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Every counter and histogram has exactly one writing thread, so updates
+// are a relaxed load and store rather than a locked read-modify-write, and
+// the exporter on the Wayland thread reads them without stopping anyone.
+class Counter {
+public:
+  void add(uint64_t amount = 1) {
+    value.store(value.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+  }
+  void set(uint64_t amount) { value.store(amount, std::memory_order_relaxed); }
+  uint64_t load() const { return value.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint64_t> value{0};
+};
+
+// Fixed-size buffer the exporters render into with snprintf, so a scrape
+// never allocates. Text past the capacity is dropped and the render is
+// marked truncated.
+class MetricsText {
+public:
+  explicit MetricsText(size_t capacity)
+      : buffer(new char[capacity]), capacity(capacity) {}
+  void clear() {
+    length = 0;
+    overflow = false;
+  }
+  void append(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  const char *data() const { return buffer.get(); }
+  size_t size() const { return length; }
+  bool truncated() const { return overflow; }
+
+private:
+  std::unique_ptr<char[]> buffer;
+  size_t capacity;
+  size_t length = 0;
+  bool overflow = false;
+};
+
+// Bucket i holds observations up to base * 2^i; the last one is +Inf.
+#define HISTOGRAM_BUCKETS 16
+
+class Histogram {
+public:
+  explicit Histogram(std::chrono::nanoseconds base) : base(base) {}
+  void observe(std::chrono::nanoseconds value);
+  // labels is empty or a comma-free list such as seat="seat1".
+  void write(MetricsText &out, const char *name, const char *labels) const;
+
+private:
+  std::chrono::nanoseconds base;
+  Counter buckets[HISTOGRAM_BUCKETS + 1];
+  Counter sum;
+};
+
+// Written by whichever thread reads the device.
+struct DeviceMetrics {
+  explicit DeviceMetrics(const std::string &path) : path(path) {}
+
+  std::string path;
+  Counter events;
+  Counter synDropped;
+  Counter activeBatches;
+  // Kernel event timestamp to the activity decision for that batch.
+  Histogram detectionLatency{std::chrono::microseconds(16)};
+};
+
+// Written by the Wayland thread.
+// One per inhibitor; with --seat each seat's are labelled with its name.
+struct InhibitorMetrics {
+  std::string seat;
+  Counter requestsSent;
+  Counter requestsAvoided;
+  Counter inhibiting;
+  // Kernel timestamp of the input that started a burst to the create
+  // request it caused.
+  Histogram requestLatency{std::chrono::microseconds(16)};
+  Histogram onDuration{std::chrono::seconds(1)};
+  Histogram offDuration{std::chrono::seconds(1)};
+};
+
+// Room for every series of 64 controllers and 8 seats, about 170 KiB.
+#define METRICS_TEXT_SIZE (256 * 1024)
+
+class Metrics {
+public:
+  DeviceMetrics *addDevice(const std::string &path);
+  void removeDevice(DeviceMetrics *device);
+  // Replaces the unlabelled inhibitor series; only called at startup.
+  InhibitorMetrics *addSeat(const std::string &seat);
+  // Renders every series into text() in the Prometheus text format and
+  // returns false if it did not fit. The device list lock is only
+  // contended while a controller is being opened or closed.
+  bool render();
+  const MetricsText &text() const { return output; }
+  bool writeFile(const std::string &path);
+
+  Counter mainWakeups;
+  Counter inputWakeups;
+  InhibitorMetrics inhibitor;
+
+private:
+  std::list<InhibitorMetrics> seats;
+  std::mutex devicesLock;
+  std::list<DeviceMetrics> devices;
+  MetricsText output{METRICS_TEXT_SIZE};
+};
+
+// Serves the current metrics to anyone who connects to a Unix socket, e.g.
+// `socat - UNIX-CONNECT:PATH`. The listening fd goes into the main epoll
+// set and every pending connection is answered and closed on wakeup,
+// without ever blocking on a slow reader.
+class MetricsSocket {
+public:
+  ~MetricsSocket();
+  bool open(const std::string &path);
+  int fd() const { return listenFd; }
+  void serve(Metrics &metrics);
+
+private:
+  int listenFd = -1;
+  std::string path;
+};
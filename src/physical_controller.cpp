@@ -0,0 +1,53 @@
+#include "physical_controller.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Drivers that do not set a resolution get their full range read as the
+// +-2000 degrees per second most controller IMUs are configured for.
+#define GYRO_FULL_SCALE 2000.0f
+
+static const unsigned int gyroAxes[3] = {ABS_RX, ABS_RY, ABS_RZ};
+
+MotionSensor::MotionSensor(const string &path) : path(path) {
+  fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    throw runtime_error("Failed to open motion sensor " + path + ": " +
+                        string(strerror(errno)));
+  }
+  for (int i = 0; i < 3; i++) {
+    input_absinfo info = {};
+    if (ioctl(fd, EVIOCGABS(gyroAxes[i]), &info) < 0) {
+      close(fd);
+      throw runtime_error("Motion sensor " + path + " has no gyroscope");
+    }
+    if (info.resolution > 0) {
+      scale[i] = 1.0f / info.resolution;
+    } else if (info.maximum > 0) {
+      scale[i] = GYRO_FULL_SCALE / info.maximum;
+    }
+  }
+}
+
+MotionSensor::~MotionSensor() { close(fd); }
+
+bool MotionSensor::sample(bool &moving) {
+  float squared = 0.0f;
+  for (int i = 0; i < 3; i++) {
+    input_absinfo info = {};
+    if (ioctl(fd, EVIOCGABS(gyroAxes[i]), &info) < 0) {
+      moving = false;
+      return errno != ENODEV;
+    }
+    float rate = info.value * scale[i];
+    squared += rate * rate;
+  }
+  moving = squared > MOTION_THRESHOLD * MOTION_THRESHOLD;
+  return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// Angular rate, in degrees per second, above which a sampled IMU counts as
+// the controller being picked up or moved. Gyro noise on a desk stays
+// well below it.
+#define MOTION_THRESHOLD 20.0f
+
+// Watches a controller's IMU node without reading its event stream. The
+// node reports around 1 kHz even when the controller lies still, so
+// instead of waking for every report the registry samples the kernel's
+// latest gyro values with EVIOCGABS at a low, fixed rate. The node is kept
+// open but never read; evdev drops what queues up in between.
+class MotionSensor {
+public:
+  explicit MotionSensor(const std::string &path);
+  MotionSensor(const MotionSensor &) = delete;
+  MotionSensor &operator=(const MotionSensor &) = delete;
+  ~MotionSensor();
+  // Returns false once the node has gone away.
+  bool sample(bool &moving);
+
+  const std::string path;
+
+private:
+  int fd = -1;
+  float scale[3] = {};
+};
+
+// Every event node that belongs to one controller, grouped by the uniq or
+// phys string its driver gives all of them.
+struct PhysicalController {
+  std::string key;
+  size_t nodes = 0;
+  uint8_t seat = 0;
+  std::unique_ptr<MotionSensor> motion;
+};
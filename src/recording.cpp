@@ -0,0 +1,154 @@
+#include "recording.h"
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+using namespace std;
+
+bool RecordingWriter::open(const string &path) {
+  file.open(path, ios::binary | ios::trunc);
+  if (!file) {
+    return false;
+  }
+  RecordingHeader header = {};
+  memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+  header.version = RECORDING_VERSION;
+  header.axisCount = AXIS_COUNT;
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  return static_cast<bool>(file);
+}
+
+void RecordingWriter::writeDevice(uint16_t device, uint16_t vendor,
+                                  uint16_t product,
+                                  const input_absinfo (&absinfo)[AXIS_COUNT]) {
+  RecordedDevice record = {};
+  record.kind = RECORD_DEVICE;
+  record.device = device;
+  record.vendor = vendor;
+  record.product = product;
+  memcpy(record.absinfo, absinfo, sizeof(record.absinfo));
+  file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+void RecordingWriter::writeEvent(uint16_t device, const input_event &ev) {
+  RecordedEvent record = {};
+  record.kind = RECORD_EVENT;
+  record.device = device;
+  record.type = ev.type;
+  record.code = ev.code;
+  record.value = ev.value;
+  record.usec = static_cast<uint32_t>(ev.input_event_usec);
+  record.sec = ev.input_event_sec;
+  file.write(reinterpret_cast<const char *>(&record), sizeof(record));
+}
+
+void RecordingWriter::flush() { file.flush(); }
+
+Recording loadRecording(const string &path) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    throw runtime_error("Failed to open recording: " + path);
+  }
+
+  RecordingHeader header = {};
+  file.read(reinterpret_cast<char *>(&header), sizeof(header));
+  if (!file || memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) ||
+      header.version != RECORDING_VERSION || header.axisCount != AXIS_COUNT) {
+    throw runtime_error("Not a waypad recording: " + path);
+  }
+
+  Recording recording;
+  uint16_t kind;
+  while (file.read(reinterpret_cast<char *>(&kind), sizeof(kind))) {
+    if (kind == RECORD_DEVICE) {
+      RecordedDevice record;
+      record.kind = kind;
+      file.read(reinterpret_cast<char *>(&record) + sizeof(kind),
+                sizeof(record) - sizeof(kind));
+      if (!file) {
+        break;
+      }
+      recording.devices.push_back(record);
+    } else if (kind == RECORD_EVENT) {
+      RecordedEvent record;
+      record.kind = kind;
+      file.read(reinterpret_cast<char *>(&record) + sizeof(kind),
+                sizeof(record) - sizeof(kind));
+      if (!file) {
+        break;
+      }
+      recording.events.push_back(record);
+    } else {
+      throw runtime_error("Corrupt record in " + path);
+    }
+  }
+  return recording;
+}
+
+static input_absinfo makeAbsInfo(int minimum, int maximum, int value) {
+  input_absinfo info = {};
+  info.minimum = minimum;
+  info.maximum = maximum;
+  info.value = value;
+  return info;
+}
+
+// An Xbox-style pad: +-32767 sticks, 10-bit triggers, reporting at 1 kHz.
+// The pattern alternates between resting with sensor noise, sweeping the
+// sticks and pressing buttons so every branch of the decoder is exercised.
+Recording synthesizeRecording(size_t eventCount, size_t deviceCount) {
+  Recording recording;
+  for (size_t d = 0; d < deviceCount; d++) {
+    RecordedDevice device = {};
+    device.kind = RECORD_DEVICE;
+    device.device = static_cast<uint16_t>(d);
+    device.vendor = 0x045e;
+    device.product = 0x028e;
+    device.absinfo[ABS_X] = makeAbsInfo(-32768, 32767, 0);
+    device.absinfo[ABS_Y] = makeAbsInfo(-32768, 32767, 0);
+    device.absinfo[ABS_RX] = makeAbsInfo(-32768, 32767, 0);
+    device.absinfo[ABS_RY] = makeAbsInfo(-32768, 32767, 0);
+    device.absinfo[ABS_Z] = makeAbsInfo(0, 1023, 0);
+    device.absinfo[ABS_RZ] = makeAbsInfo(0, 1023, 0);
+    recording.devices.push_back(device);
+  }
+
+  mt19937 rng(1);
+  uniform_int_distribution<int> noise(-600, 600);
+  recording.events.reserve(eventCount);
+
+  int64_t usec = 0;
+  for (size_t frame = 0; recording.events.size() < eventCount; frame++) {
+    uint16_t device = static_cast<uint16_t>(frame % deviceCount);
+    size_t phase = (frame / deviceCount) % 3000;
+    auto push = [&](uint16_t type, uint16_t code, int32_t value) {
+      RecordedEvent ev = {};
+      ev.kind = RECORD_EVENT;
+      ev.device = device;
+      ev.type = type;
+      ev.code = code;
+      ev.value = value;
+      ev.sec = usec / 1000000;
+      ev.usec = static_cast<uint32_t>(usec % 1000000);
+      recording.events.push_back(ev);
+    };
+
+    if (phase < 1000) {
+      push(EV_ABS, ABS_X, noise(rng));
+      push(EV_ABS, ABS_Y, noise(rng));
+      push(EV_ABS, ABS_RY, noise(rng));
+      push(EV_ABS, ABS_Z, 0);
+    } else if (phase < 2000) {
+      int sweep = static_cast<int>(phase - 1000) * 64 - 32000;
+      push(EV_ABS, ABS_X, sweep);
+      push(EV_ABS, ABS_RY, -sweep);
+      push(EV_ABS, ABS_Z, static_cast<int>(phase - 1000));
+    } else {
+      push(EV_KEY, BTN_A + (phase / 2) % 11, (phase + 1) % 2);
+      push(EV_ABS, ABS_RX, noise(rng));
+    }
+    push(EV_SYN, SYN_REPORT, 0);
+    usec += 1000 / deviceCount + 1;
+  }
+  return recording;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "gamepad.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// On-disk layout of a --record capture, in host byte order. A file starts
+// with a RecordingHeader followed by a stream of records, each beginning
+// with a RecordKind tag. A RecordedDevice is written when a controller is
+// opened and carries the abs ranges needed to normalise its events; every
+// input_event read from that controller follows as a RecordedEvent with its
+// kernel timestamp.
+static constexpr char RECORDING_MAGIC[8] = {'W', 'P', 'A', 'D',
+                                            'R', 'E', 'C', '\0'};
+static constexpr uint32_t RECORDING_VERSION = 1;
+
+struct RecordingHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t axisCount;
+};
+
+enum RecordKind : uint16_t { RECORD_DEVICE = 1, RECORD_EVENT = 2 };
+
+struct RecordedDevice {
+  uint16_t kind;
+  uint16_t device;
+  uint16_t vendor;
+  uint16_t product;
+  input_absinfo absinfo[AXIS_COUNT];
+};
+
+struct RecordedEvent {
+  uint16_t kind;
+  uint16_t device;
+  uint16_t type;
+  uint16_t code;
+  int32_t value;
+  uint32_t usec;
+  int64_t sec;
+};
+
+static_assert(sizeof(RecordedDevice) == 8 + 24 * AXIS_COUNT,
+              "RecordedDevice must not be padded");
+static_assert(sizeof(RecordedEvent) == 24, "RecordedEvent must be 24 bytes");
+
+class RecordingWriter {
+public:
+  bool open(const std::string &path);
+  void writeDevice(uint16_t device, uint16_t vendor, uint16_t product,
+                   const input_absinfo (&absinfo)[AXIS_COUNT]);
+  void writeEvent(uint16_t device, const input_event &ev);
+  void flush();
+
+private:
+  std::ofstream file;
+};
+
+struct Recording {
+  std::vector<RecordedDevice> devices;
+  std::vector<RecordedEvent> events;
+};
+
+Recording loadRecording(const std::string &path);
+Recording synthesizeRecording(size_t eventCount, size_t deviceCount);
+
+inline input_event toInputEvent(const RecordedEvent &recorded) {
+  input_event ev = {};
+  ev.input_event_sec = recorded.sec;
+  ev.input_event_usec = recorded.usec;
+  ev.type = recorded.type;
+  ev.code = recorded.code;
+  ev.value = recorded.value;
+  return ev;
+}
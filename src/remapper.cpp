@@ -0,0 +1,288 @@
+#include "remapper.h"
+#include "virtual_gamepad.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Analog inputs driving keys press past REMAP_PRESS and release below
+// REMAP_RELEASE, so a stick resting on the threshold does not chatter.
+#define REMAP_PRESS 0.50f
+#define REMAP_RELEASE 0.35f
+// A stalled loop must not turn into one huge pointer jump.
+#define REMAP_MAX_STEP std::chrono::milliseconds(50)
+
+static const RemapProfile remapProfiles[] = {
+    {"desktop",
+     {BTN_LEFT, BTN_RIGHT, 0, BTN_MIDDLE, KEY_ENTER, 0, KEY_BACK, KEY_FORWARD,
+      0, 0, KEY_ESC, KEY_ENTER, KEY_LEFTMETA, KEY_LEFTSHIFT, KEY_LEFTCTRL},
+     {KEY_PAGEUP, KEY_PAGEDOWN},
+     {StickMode::Pointer, StickMode::Scroll},
+     {{0, 0, 0, 0}, {0, 0, 0, 0}},
+     1500.0f,
+     15.0f,
+     2.2f,
+     0.15f},
+    {"wasd",
+     {KEY_SPACE, KEY_LEFTCTRL, 0, KEY_R, KEY_E, 0, KEY_Q, KEY_F, 0, 0,
+      KEY_TAB, KEY_ESC, 0, KEY_LEFTSHIFT, KEY_V},
+     {BTN_RIGHT, BTN_LEFT},
+     {StickMode::Keys, StickMode::Pointer},
+     {{KEY_W, KEY_S, KEY_A, KEY_D}, {0, 0, 0, 0}},
+     2000.0f,
+     15.0f,
+     1.8f,
+     0.12f},
+};
+
+const RemapProfile *findRemapProfile(const string &name) {
+  for (const RemapProfile &profile : remapProfiles) {
+    if (name == profile.name) {
+      return &profile;
+    }
+  }
+  return nullptr;
+}
+
+RemapTable::RemapTable(const RemapProfile &profile) : profile(profile) {
+  for (int i = 0; i <= REMAP_CURVE_STEPS; i++) {
+    curve[i] = powf(static_cast<float>(i) / REMAP_CURVE_STEPS,
+                    profile.exponent);
+  }
+}
+
+// Deflection past the deadzone is rescaled to 0..1 before the curve.
+float RemapTable::speed(float deflection) const {
+  if (deflection <= profile.deadzone) {
+    return 0.0f;
+  }
+  float unit = min(1.0f, (deflection - profile.deadzone) /
+                             (1.0f - profile.deadzone));
+  return curve[static_cast<int>(unit * REMAP_CURVE_STEPS + 0.5f)];
+}
+
+static bool enableKey(int fd, uint16_t code) {
+  return code == 0 || ioctl(fd, UI_SET_KEYBIT, code) == 0;
+}
+
+Remapper::Remapper(const RemapTable &table, int outputFd)
+    : table(table), fd(outputFd) {
+  if (fd != -1) {
+    return;
+  }
+  fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    throw runtime_error("Failed to open /dev/uinput: " +
+                        string(strerror(errno)));
+  }
+  ownsFd = true;
+
+  const RemapProfile &profile = table.profile;
+  bool ok = ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_REL) == 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0;
+  for (uint16_t code : profile.buttons) {
+    ok = ok && enableKey(fd, code);
+  }
+  for (uint16_t code : profile.triggers) {
+    ok = ok && enableKey(fd, code);
+  }
+  for (const auto &keys : profile.stickKeys) {
+    for (uint16_t code : keys) {
+      ok = ok && enableKey(fd, code);
+    }
+  }
+  for (uint16_t code : {REL_X, REL_Y, REL_WHEEL, REL_HWHEEL}) {
+    ok = ok && ioctl(fd, UI_SET_RELBIT, code) == 0;
+  }
+
+  struct uinput_setup setup = {};
+  setup.id.bustype = BUS_VIRTUAL;
+  snprintf(setup.name, UINPUT_MAX_NAME_SIZE, "waypad remap (%s)",
+           profile.name);
+  ok = ok && ioctl(fd, UI_DEV_SETUP, &setup) == 0 &&
+       ioctl(fd, UI_DEV_CREATE) == 0;
+  if (!ok) {
+    int error = errno;
+    close(fd);
+    throw runtime_error("Failed to create remapping device: " +
+                        string(strerror(error)));
+  }
+}
+
+string Remapper::devicePath() const {
+  return ownsFd ? uinputNode(fd) : "";
+}
+
+Remapper::~Remapper() {
+  if (ownsFd) {
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+  }
+}
+
+// Buttons are looked up through the controller's profile, the same decode
+// activity detection uses, so a button is remapped by the state bit it
+// sets rather than by the code its driver sends.
+void Remapper::translate(const input_event &ev,
+                         const ControllerProfile &controller) {
+  DecodeSlot slot = controller.decode(ev.type, ev.code);
+  if (slot.kind != DecodeKind::Button) {
+    return;
+  }
+  unsigned int bit = slot.index;
+  if (bit < REMAP_BUTTON_COUNT && table.profile.buttons[bit] != 0) {
+    setKey(table.profile.buttons[bit], ev.value != 0, heldButtons, bit);
+  }
+}
+
+// Sticks are measured from the model's calibrated centre, the same origin
+// activity detection uses.
+void Remapper::flush(const GamepadModel &model, Clock::time_point now) {
+  const RemapProfile &profile = table.profile;
+  static constexpr unsigned int stickAxes[2][2] = {{ABS_X, ABS_Y},
+                                                   {ABS_RX, ABS_RY}};
+  bool wasMoving = moving;
+  moving = false;
+  for (int stick = 0; stick < 2; stick++) {
+    float dx = model.state.axes[stickAxes[stick][0]] -
+               model.centre[stickAxes[stick][0]];
+    float dy = model.state.axes[stickAxes[stick][1]] -
+               model.centre[stickAxes[stick][1]];
+    switch (profile.sticks[stick]) {
+    case StickMode::Keys: {
+      const float push[4] = {-dy, dy, -dx, dx};
+      for (int dir = 0; dir < 4; dir++) {
+        unsigned int bit = stick * 4 + dir;
+        bool down = (heldAnalog >> bit) & 1;
+        float limit = down ? REMAP_RELEASE : REMAP_PRESS;
+        setKey(profile.stickKeys[stick][dir], push[dir] > limit, heldAnalog,
+               bit);
+      }
+      break;
+    }
+    case StickMode::Pointer:
+    case StickMode::Scroll: {
+      float magnitude = sqrtf(dx * dx + dy * dy);
+      float speed = table.speed(magnitude) *
+                    (profile.sticks[stick] == StickMode::Pointer
+                         ? profile.pointerSpeed
+                         : profile.scrollSpeed);
+      float scale = speed > 0.0f ? speed / magnitude : 0.0f;
+      velocity[stick][0] = dx * scale;
+      velocity[stick][1] = dy * scale;
+      moving |= speed > 0.0f;
+      break;
+    }
+    case StickMode::None:
+      break;
+    }
+  }
+  for (int trigger = 0; trigger < 2; trigger++) {
+    unsigned int bit = 8 + trigger;
+    bool down = (heldAnalog >> bit) & 1;
+    float value = model.state.axes[trigger == 0 ? ABS_Z : ABS_RZ];
+    setKey(profile.triggers[trigger],
+           value > (down ? REMAP_RELEASE : REMAP_PRESS), heldAnalog, bit);
+  }
+
+  // A stick that just left the deadzone moves by one tick straight away
+  // rather than waiting for the timer.
+  if (moving && !wasMoving) {
+    lastMove = now - REMAP_TICK;
+  }
+  if (moving || wasMoving) {
+    move(now);
+  }
+  write();
+}
+
+void Remapper::tick(Clock::time_point now) {
+  if (moving) {
+    move(now);
+    write();
+  }
+}
+
+void Remapper::move(Clock::time_point now) {
+  float seconds =
+      chrono::duration<float>(min<Clock::duration>(now - lastMove,
+                                                   REMAP_MAX_STEP))
+          .count();
+  lastMove = now;
+  for (int stick = 0; stick < 2; stick++) {
+    StickMode mode = table.profile.sticks[stick];
+    if (mode != StickMode::Pointer && mode != StickMode::Scroll) {
+      continue;
+    }
+    int32_t steps[2];
+    for (int axis = 0; axis < 2; axis++) {
+      float total = remainder[stick][axis] + velocity[stick][axis] * seconds;
+      steps[axis] = static_cast<int32_t>(total);
+      remainder[stick][axis] = velocity[stick][axis] != 0.0f
+                                   ? total - steps[axis]
+                                   : 0.0f;
+    }
+    if (mode == StickMode::Pointer) {
+      if (steps[0]) {
+        queue(EV_REL, REL_X, steps[0]);
+      }
+      if (steps[1]) {
+        queue(EV_REL, REL_Y, steps[1]);
+      }
+    } else {
+      // Pushing the stick up scrolls up, which is a positive wheel value.
+      if (steps[0]) {
+        queue(EV_REL, REL_HWHEEL, steps[0]);
+      }
+      if (steps[1]) {
+        queue(EV_REL, REL_WHEEL, -steps[1]);
+      }
+    }
+  }
+}
+
+void Remapper::setKey(uint16_t code, bool down, uint64_t &held,
+                      unsigned int bit) {
+  uint64_t mask = uint64_t(1) << bit;
+  if (code == 0 || down == ((held & mask) != 0)) {
+    return;
+  }
+  held = down ? held | mask : held & ~mask;
+  queue(EV_KEY, code, down ? 1 : 0);
+}
+
+// One slot is always left for the SYN_REPORT that closes the write.
+void Remapper::queue(uint16_t type, uint16_t code, int32_t value) {
+  if (pendingCount == REMAP_MAX_EVENTS - 1) {
+    write();
+  }
+  input_event &ev = pending[pendingCount++];
+  ev = input_event{};
+  ev.type = type;
+  ev.code = code;
+  ev.value = value;
+}
+
+void Remapper::write() {
+  if (pendingCount == 0) {
+    return;
+  }
+  input_event &syn = pending[pendingCount++];
+  syn = input_event{};
+  syn.type = EV_SYN;
+  syn.code = SYN_REPORT;
+  size_t length = pendingCount * sizeof(input_event);
+  pendingCount = 0;
+  // uinput only rejects a write once the device is gone, and the events
+  // go with it.
+  (void)!::write(fd, pending, length);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "gamepad.h"
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#define REMAP_BUTTON_COUNT (BTN_THUMBR - BTN_A + 1)
+#define REMAP_CURVE_STEPS 256
+#define REMAP_MAX_EVENTS 64
+// How often a deflected stick moves the pointer between read batches.
+#define REMAP_TICK std::chrono::milliseconds(2)
+
+// What a stick drives: nothing, the pointer, the scroll wheels, or four
+// keys for up, down, left and right.
+enum class StickMode : uint8_t { None, Pointer, Scroll, Keys };
+
+// A human-editable mapping. Output codes are evdev KEY_* or BTN_* codes;
+// zero leaves an input unmapped.
+struct RemapProfile {
+  const char *name;
+  // By GamepadState button bit, i.e. the BTN_A..BTN_THUMBR slot the
+  // controller's profile decodes a button to.
+  uint16_t buttons[REMAP_BUTTON_COUNT];
+  uint16_t triggers[2];
+  StickMode sticks[2];
+  uint16_t stickKeys[2][4];
+  // Full deflection moves the pointer this many pixels per second and the
+  // wheel this many detents per second.
+  float pointerSpeed;
+  float scrollSpeed;
+  // Speed grows with deflection^exponent, so small deflections stay
+  // precise and full deflection is fast.
+  float exponent;
+  float deadzone;
+};
+
+const RemapProfile *findRemapProfile(const std::string &name);
+
+// A profile compiled for the hot path: the response curve is sampled into
+// a table so the per-report work is a few multiplies and a lookup.
+struct RemapTable {
+  explicit RemapTable(const RemapProfile &profile);
+  float speed(float deflection) const;
+
+  RemapProfile profile;
+  float curve[REMAP_CURVE_STEPS + 1];
+};
+
+// Translates one controller into keyboard and mouse input on its own
+// uinput device. Button edges are translated event by event, so a tap
+// inside one read batch survives, and the sticks and triggers are read
+// from the model once per batch. Everything queued during a batch goes out
+// in a single write() at flush(). While a stick is deflected, tick() keeps
+// the pointer or wheel moving between batches.
+class Remapper {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  // With outputFd the events are written there instead of to a new uinput
+  // device; the fd is not owned.
+  explicit Remapper(const RemapTable &table, int outputFd = -1);
+  Remapper(const Remapper &) = delete;
+  Remapper &operator=(const Remapper &) = delete;
+  ~Remapper();
+  void translate(const input_event &ev, const ControllerProfile &controller);
+  void flush(const GamepadModel &model, Clock::time_point now);
+  void tick(Clock::time_point now);
+  bool isMoving() const { return moving; }
+  // Only informational, so it is looked up when asked for rather than
+  // waited for when the device is created. Empty with outputFd.
+  std::string devicePath() const;
+
+private:
+  void queue(uint16_t type, uint16_t code, int32_t value);
+  void setKey(uint16_t code, bool down, uint64_t &held, unsigned int bit);
+  void move(Clock::time_point now);
+  void write();
+
+  const RemapTable &table;
+  int fd = -1;
+  bool ownsFd = false;
+  uint64_t heldButtons = 0;
+  uint64_t heldAnalog = 0;
+  float velocity[2][2] = {};
+  float remainder[2][2] = {};
+  bool moving = false;
+  Clock::time_point lastMove;
+  input_event pending[REMAP_MAX_EVENTS];
+  size_t pendingCount = 0;
+};
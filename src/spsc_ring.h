@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Bounded single-producer/single-consumer queue. push() and pop() are
+// wait-free: each side only stores its own index and reads the other's,
+// and the two indices live on separate cache lines so the producer and
+// consumer never write to the same line.
+template <typename T, size_t Capacity> class SpscRing {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+                "Capacity must be a power of two");
+
+public:
+  bool push(const T &value) {
+    size_t head = this->head.load(std::memory_order_relaxed);
+    if (head - tailCache == Capacity) {
+      tailCache = tail.load(std::memory_order_acquire);
+      if (head - tailCache == Capacity) {
+        return false;
+      }
+    }
+    slots[head & (Capacity - 1)] = value;
+    this->head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value) {
+    size_t tail = this->tail.load(std::memory_order_relaxed);
+    if (tail == headCache) {
+      headCache = head.load(std::memory_order_acquire);
+      if (tail == headCache) {
+        return false;
+      }
+    }
+    value = slots[tail & (Capacity - 1)];
+    this->tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  alignas(64) std::atomic<size_t> head{0};
+  size_t tailCache = 0;
+  alignas(64) std::atomic<size_t> tail{0};
+  size_t headCache = 0;
+  alignas(64) T slots[Capacity];
+};
@@ -0,0 +1,163 @@
+#include "state_snapshot.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <new>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+static int64_t monotonicNs(chrono::steady_clock::time_point time) {
+  return chrono::duration_cast<chrono::nanoseconds>(time.time_since_epoch())
+      .count();
+}
+
+// Writer side of the seqlock: the odd count is visible before any of the
+// new data, and the data before the final even count.
+static void beginWrite(atomic<uint32_t> &sequence) {
+  sequence.store(sequence.load(memory_order_relaxed) + 1,
+                 memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+}
+
+static void endWrite(atomic<uint32_t> &sequence) {
+  sequence.store(sequence.load(memory_order_relaxed) + 1,
+                 memory_order_release);
+}
+
+static_assert(SNAPSHOT_SLOTS <= 64, "usedSlots is a 64-bit mask");
+
+// Readers that still have the object mapped see magic cleared and every
+// slot empty, rather than a frozen state.
+StateSnapshot::~StateSnapshot() {
+  if (!shared) {
+    return;
+  }
+  for (int slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+    if (usedSlots >> slot & 1) {
+      release(slot);
+    }
+  }
+  __atomic_store_n(&shared->magic, 0, __ATOMIC_RELEASE);
+  munmap(shared, sizeof(SharedState));
+  shm_unlink(name.c_str());
+  close(fd);
+}
+
+// The object is owner-only, as button state is as private as keystrokes.
+// Whoever publishes it holds an flock() on it, so one that can be locked
+// was left behind by a daemon that died and is replaced rather than
+// reused, while one still locked belongs to a running instance and open()
+// fails with EBUSY instead of detaching it. An object someone else created
+// under the name is never written to either: it cannot be opened, the
+// sticky /dev/shm keeps it from being unlinked and O_EXCL then fails.
+bool StateSnapshot::open(const string &name) {
+  this->name = name[0] == '/' ? name : "/" + name;
+  int existing = shm_open(this->name.c_str(), O_RDWR | O_CLOEXEC, 0);
+  if (existing != -1) {
+    bool live = flock(existing, LOCK_EX | LOCK_NB) == -1;
+    close(existing);
+    if (live) {
+      errno = EBUSY;
+      return false;
+    }
+    shm_unlink(this->name.c_str());
+  }
+  fd = shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+                0600);
+  if (fd == -1) {
+    return false;
+  }
+  if (flock(fd, LOCK_EX | LOCK_NB) == -1 || fchmod(fd, 0600) == -1 ||
+      ftruncate(fd, sizeof(SharedState)) == -1) {
+    int error = errno;
+    close(fd);
+    fd = -1;
+    errno = error;
+    return false;
+  }
+  void *memory = mmap(nullptr, sizeof(SharedState), PROT_READ | PROT_WRITE,
+                      MAP_SHARED, fd, 0);
+  if (memory == MAP_FAILED) {
+    int error = errno;
+    close(fd);
+    fd = -1;
+    errno = error;
+    return false;
+  }
+  memset(memory, 0, sizeof(SharedState));
+  shared = new (memory) SharedState;
+  shared->version = SNAPSHOT_VERSION;
+  shared->deviceSize = sizeof(SnapshotDevice);
+  shared->slots = SNAPSHOT_SLOTS;
+  shared->inhibitor.pid = static_cast<uint32_t>(getpid());
+  __atomic_store_n(&shared->magic, SNAPSHOT_MAGIC, __ATOMIC_RELEASE);
+  return true;
+}
+
+int StateSnapshot::acquire(const string &path, uint16_t vendor,
+                           uint16_t product, NodeRole role) {
+  if (!shared || ~usedSlots == 0) {
+    return -1;
+  }
+  int slot = __builtin_ctzll(~usedSlots);
+  if (slot >= SNAPSHOT_SLOTS) {
+    return -1;
+  }
+  usedSlots |= uint64_t(1) << slot;
+  SnapshotDevice &device = shared->devices[slot];
+  beginWrite(device.sequence);
+  SnapshotDeviceState &state = device.state;
+  memset(&state, 0, sizeof(state));
+  state.flags = SNAPSHOT_PRESENT |
+                (role == NodeRole::Touchpad ? SNAPSHOT_TOUCHPAD : 0);
+  state.vendor = vendor;
+  state.product = product;
+  strncpy(state.path, path.c_str(), SNAPSHOT_PATH_SIZE - 1);
+  state.path[SNAPSHOT_PATH_SIZE - 1] = '\0';
+  endWrite(device.sequence);
+  return slot;
+}
+
+void StateSnapshot::release(int slot) {
+  if (!shared || slot < 0) {
+    return;
+  }
+  SnapshotDevice &device = shared->devices[slot];
+  beginWrite(device.sequence);
+  memset(&device.state, 0, sizeof(device.state));
+  endWrite(device.sequence);
+  usedSlots &= ~(uint64_t(1) << slot);
+}
+
+// Called after every batch, so it only touches the hot half of the block.
+void StateSnapshot::publish(int slot, const GamepadModel &model, bool active,
+                            chrono::steady_clock::time_point activity) {
+  if (!shared || slot < 0) {
+    return;
+  }
+  SnapshotDevice &device = shared->devices[slot];
+  beginWrite(device.sequence);
+  SnapshotDeviceState &state = device.state;
+  state.flags =
+      (state.flags & ~SNAPSHOT_ACTIVE) | (active ? SNAPSHOT_ACTIVE : 0);
+  state.buttons = model.state.buttons;
+  memcpy(state.axes, model.state.axes, sizeof(state.axes));
+  if (activity != chrono::steady_clock::time_point()) {
+    state.lastActivity = monotonicNs(activity);
+  }
+  endWrite(device.sequence);
+}
+
+void StateSnapshot::publishInhibitor(bool inhibiting,
+                                     chrono::steady_clock::time_point now) {
+  if (!shared || shared->inhibitor.inhibiting == uint32_t(inhibiting)) {
+    return;
+  }
+  beginWrite(shared->sequence);
+  shared->inhibitor.inhibiting = inhibiting;
+  shared->inhibitor.changed = monotonicNs(now);
+  endWrite(shared->sequence);
+}
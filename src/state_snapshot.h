@@ -0,0 +1,125 @@
+#pragma once
+
+#include "gamepad.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Layout of the shared state region, e.g. /dev/shm/waypad. Everything is
+// native-endian and fixed-size so readers in any language can map it.
+// Bump SNAPSHOT_VERSION on any change.
+#define SNAPSHOT_MAGIC 0x53505957 // "WYPS"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_SLOTS 64
+#define SNAPSHOT_PATH_SIZE 64
+
+// SnapshotDeviceState::flags
+#define SNAPSHOT_PRESENT 0x1
+#define SNAPSHOT_ACTIVE 0x2
+#define SNAPSHOT_TOUCHPAD 0x4
+
+// Timestamps are CLOCK_MONOTONIC nanoseconds, zero for never.
+struct SnapshotDeviceState {
+  uint32_t flags;
+  uint16_t vendor;
+  uint16_t product;
+  // GamepadState's mask and normalised axes.
+  uint64_t buttons;
+  float axes[AXIS_COUNT];
+  // Kernel timestamp of the latest batch that counted as activity.
+  int64_t lastActivity;
+  char path[SNAPSHOT_PATH_SIZE];
+};
+
+struct SnapshotInhibitorState {
+  uint32_t inhibiting;
+  uint32_t pid;
+  // When the inhibitor was last created or destroyed.
+  int64_t changed;
+};
+
+// Each block is guarded by its own sequence counter: odd while the daemon
+// is writing, bumped by two per update. A reader loads it, copies the
+// block, and retries if the counter was odd or changed meanwhile; see
+// readSnapshot(). Blocks sit on their own cache lines so the input thread
+// and the Wayland thread never write to the same line.
+struct alignas(64) SnapshotDevice {
+  std::atomic<uint32_t> sequence;
+  SnapshotDeviceState state;
+};
+
+struct alignas(64) SharedState {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t deviceSize;
+  uint32_t slots;
+  alignas(64) std::atomic<uint32_t> sequence;
+  SnapshotInhibitorState inhibitor;
+  SnapshotDevice devices[SNAPSHOT_SLOTS];
+};
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "sequence counters must work across processes");
+static_assert(sizeof(SnapshotDevice) == 128, "device blocks are two lines");
+
+// Sequence loads readSnapshot() makes before giving up on a block.
+#define SNAPSHOT_READ_ATTEMPTS 1000
+
+// Consistent copy of one seqlock-guarded block. Returns false after
+// SNAPSHOT_READ_ATTEMPTS loads that each found the block being written or
+// changed during the copy, and out may then be torn. That is a few
+// microseconds of spinning, which a live writer busy with one block can
+// outlast now and then, and it is what a writer that died mid-update
+// always looks like; either way the caller keeps its previous copy and
+// tries again on its next poll.
+template <typename State>
+bool readSnapshot(const std::atomic<uint32_t> &sequence, const State &shared,
+                  State &out) {
+  for (int attempt = 0; attempt < SNAPSHOT_READ_ATTEMPTS; attempt++) {
+    uint32_t before = sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;
+    }
+    memcpy(&out, &shared, sizeof(State));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (sequence.load(std::memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Publishes live controller and inhibitor state to a POSIX shared memory
+// object that other tools (overlays, telemetry) mmap read-only and poll
+// without any syscalls or locks shared with the daemon. Device slots are
+// written by whichever thread reads the devices, the inhibitor block by
+// the Wayland thread.
+class StateSnapshot {
+public:
+  StateSnapshot() = default;
+  StateSnapshot(const StateSnapshot &) = delete;
+  StateSnapshot &operator=(const StateSnapshot &) = delete;
+  ~StateSnapshot();
+  bool open(const std::string &name);
+  // Returns the slot for a newly opened device, or -1 if all are taken.
+  // The slot reads as present and idle until the first publish().
+  int acquire(const std::string &path, uint16_t vendor, uint16_t product,
+              NodeRole role);
+  void release(int slot);
+  // activity is the kernel timestamp of the batch if it counted as
+  // activity, or a default time_point to keep the previous one.
+  void publish(int slot, const GamepadModel &model, bool active,
+               std::chrono::steady_clock::time_point activity);
+  void publishInhibitor(bool inhibiting,
+                        std::chrono::steady_clock::time_point now);
+
+private:
+  SharedState *shared = nullptr;
+  // Kept open and flock()ed for as long as the object is published, which
+  // is how another instance tells a live object from a stale one.
+  int fd = -1;
+  std::string name;
+  uint64_t usedSlots = 0;
+};
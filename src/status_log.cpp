@@ -0,0 +1,76 @@
+#include "status_log.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+
+using namespace std;
+
+struct StatusEntry {
+  const char *message;
+  char detail[STATUS_DETAIL_SIZE];
+};
+
+// Both the input thread and the Wayland thread log, but rarely enough that
+// a mutex costs nothing. pending lets the per-iteration flush skip the lock
+// when there is nothing to write.
+static mutex statusLock;
+static StatusEntry statusRing[STATUS_LOG_ENTRIES];
+static size_t statusHead = 0;
+static size_t statusCount = 0;
+static size_t statusDropped = 0;
+static atomic<bool> statusPending{false};
+
+void logStatus(const char *message, const char *detail) {
+  lock_guard<mutex> guard(statusLock);
+  if (statusCount == STATUS_LOG_ENTRIES) {
+    statusDropped++;
+    return;
+  }
+  StatusEntry &entry =
+      statusRing[(statusHead + statusCount) % STATUS_LOG_ENTRIES];
+  entry.message = message;
+  if (detail) {
+    strncpy(entry.detail, detail, STATUS_DETAIL_SIZE - 1);
+    entry.detail[STATUS_DETAIL_SIZE - 1] = '\0';
+  } else {
+    entry.detail[0] = '\0';
+  }
+  statusCount++;
+  statusPending.store(true, memory_order_release);
+}
+
+// Entries are taken out one at a time so a blocking write() never holds the
+// lock a logging thread is waiting for.
+void flushStatusLog(int fd) {
+  if (!statusPending.load(memory_order_acquire)) {
+    return;
+  }
+  char line[STATUS_DETAIL_SIZE + 128];
+  while (true) {
+    int length;
+    {
+      lock_guard<mutex> guard(statusLock);
+      if (statusCount == 0) {
+        if (statusDropped == 0) {
+          statusPending.store(false, memory_order_relaxed);
+          return;
+        }
+        length = snprintf(line, sizeof(line), "(%zu status lines dropped)\n",
+                          statusDropped);
+        statusDropped = 0;
+      } else {
+        const StatusEntry &entry = statusRing[statusHead];
+        length = entry.detail[0] != '\0'
+                     ? snprintf(line, sizeof(line), "%s: %s\n", entry.message,
+                                entry.detail)
+                     : snprintf(line, sizeof(line), "%s\n", entry.message);
+        statusHead = (statusHead + 1) % STATUS_LOG_ENTRIES;
+        statusCount--;
+      }
+    }
+    size_t size = min(static_cast<size_t>(length), sizeof(line) - 1);
+    (void)!write(fd, line, size);
+  }
+}
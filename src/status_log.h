@@ -0,0 +1,15 @@
+#pragma once
+
+#include <unistd.h>
+
+#define STATUS_LOG_ENTRIES 256
+#define STATUS_DETAIL_SIZE 120
+
+// Status lines from the event loops ("controller is active", hotplug) go
+// into a fixed ring instead of through cout, so logging never allocates
+// and never blocks on a slow stdout. message must be a string literal; the
+// detail, usually a device path, is copied and truncated to fit. Lines are
+// formatted and written out by flushStatusLog(), which the loops call once
+// per iteration. When the ring is full new lines are dropped and counted.
+void logStatus(const char *message, const char *detail = nullptr);
+void flushStatusLog(int fd = STDOUT_FILENO);
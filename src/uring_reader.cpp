@@ -0,0 +1,235 @@
+#include "uring_reader.h"
+
+#ifdef WAYPAD_HAVE_IO_URING
+
+#include <cerrno>
+#include <cstdint>
+#include <liburing.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define URING_ENTRIES 256
+#define URING_BUFFER_GROUP 0
+#define URING_BUFFER_COUNT 64
+#define URING_BUFFER_EVENTS 64
+// user_data of cancel requests, whose completions are ignored.
+#define URING_CANCEL_DATA UINT64_MAX
+
+struct UringReader::Impl {
+  // One per armed fd. The generation is bumped on disarm, which makes
+  // every completion tagged with the old one stale.
+  struct Slot {
+    int fd = -1;
+    uint32_t generation = 0;
+  };
+
+  struct io_uring ring = {};
+  bool ringReady = false;
+  struct io_uring_buf_ring *bufferRing = nullptr;
+  int eventFd = -1;
+  vector<input_event> buffers;
+  vector<Slot> slots;
+  vector<uint32_t> rearm;
+
+  ~Impl() {
+    if (bufferRing) {
+      io_uring_free_buf_ring(&ring, bufferRing, URING_BUFFER_COUNT,
+                             URING_BUFFER_GROUP);
+    }
+    if (ringReady) {
+      io_uring_queue_exit(&ring);
+    }
+    if (eventFd != -1) {
+      close(eventFd);
+    }
+  }
+
+  void provide(unsigned short id, int offset) {
+    io_uring_buf_ring_add(bufferRing, &buffers[id * URING_BUFFER_EVENTS],
+                          URING_BUFFER_EVENTS * sizeof(input_event), id,
+                          io_uring_buf_ring_mask(URING_BUFFER_COUNT), offset);
+  }
+
+  struct io_uring_sqe *sqe() {
+    struct io_uring_sqe *entry = io_uring_get_sqe(&ring);
+    if (!entry) {
+      io_uring_submit(&ring);
+      entry = io_uring_get_sqe(&ring);
+    }
+    return entry;
+  }
+
+  static uint64_t tag(uint32_t slot, uint32_t generation) {
+    return static_cast<uint64_t>(generation) << 32 | slot;
+  }
+
+  bool post(uint32_t slot) {
+    struct io_uring_sqe *entry = sqe();
+    if (!entry) {
+      return false;
+    }
+    io_uring_prep_read_multishot(entry, slots[slot].fd, 0, 0,
+                                 URING_BUFFER_GROUP);
+    io_uring_sqe_set_data64(entry, tag(slot, slots[slot].generation));
+    return io_uring_submit(&ring) >= 0;
+  }
+
+  // The slot the completion belongs to, or -1 if it was disarmed since.
+  int64_t lookup(uint64_t data) const {
+    uint32_t slot = static_cast<uint32_t>(data);
+    if (slot >= slots.size() || slots[slot].fd == -1 ||
+        slots[slot].generation != static_cast<uint32_t>(data >> 32)) {
+      return -1;
+    }
+    return slot;
+  }
+};
+
+unique_ptr<UringReader> UringReader::create() {
+  auto impl = make_unique<Impl>();
+  if (io_uring_queue_init(URING_ENTRIES, &impl->ring, 0) < 0) {
+    return nullptr;
+  }
+  impl->ringReady = true;
+
+  struct io_uring_probe *probe = io_uring_get_probe_ring(&impl->ring);
+  bool supported =
+      probe && io_uring_opcode_supported(probe, IORING_OP_READ_MULTISHOT);
+  if (probe) {
+    io_uring_free_probe(probe);
+  }
+  if (!supported) {
+    return nullptr;
+  }
+
+  int rc = 0;
+  impl->bufferRing = io_uring_setup_buf_ring(&impl->ring, URING_BUFFER_COUNT,
+                                             URING_BUFFER_GROUP, 0, &rc);
+  if (!impl->bufferRing) {
+    return nullptr;
+  }
+  impl->buffers.resize(URING_BUFFER_COUNT * URING_BUFFER_EVENTS);
+  for (unsigned short id = 0; id < URING_BUFFER_COUNT; id++) {
+    impl->provide(id, id);
+  }
+  io_uring_buf_ring_advance(impl->bufferRing, URING_BUFFER_COUNT);
+
+  impl->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (impl->eventFd == -1 ||
+      io_uring_register_eventfd(&impl->ring, impl->eventFd) < 0) {
+    return nullptr;
+  }
+  impl->slots.reserve(URING_ENTRIES);
+  impl->rearm.reserve(URING_ENTRIES);
+  return unique_ptr<UringReader>(new UringReader(move(impl)));
+}
+
+UringReader::UringReader(unique_ptr<Impl> impl) : impl(move(impl)) {}
+
+UringReader::~UringReader() {}
+
+int UringReader::notifyFd() const { return impl->eventFd; }
+
+bool UringReader::arm(int fd) {
+  uint32_t slot = 0;
+  while (slot < impl->slots.size() && impl->slots[slot].fd != -1) {
+    slot++;
+  }
+  if (slot == impl->slots.size()) {
+    impl->slots.emplace_back();
+  }
+  impl->slots[slot].fd = fd;
+  if (!impl->post(slot)) {
+    impl->slots[slot].fd = -1;
+    return false;
+  }
+  return true;
+}
+
+// The read holds its own reference to the file, so closing the fd alone
+// would leave it posted until the device goes away.
+void UringReader::disarm(int fd) {
+  for (uint32_t slot = 0; slot < impl->slots.size(); slot++) {
+    Impl::Slot &armed = impl->slots[slot];
+    if (armed.fd != fd) {
+      continue;
+    }
+    struct io_uring_sqe *sqe = impl->sqe();
+    if (sqe) {
+      io_uring_prep_cancel64(sqe, Impl::tag(slot, armed.generation), 0);
+      io_uring_sqe_set_data64(sqe, URING_CANCEL_DATA);
+      io_uring_submit(&impl->ring);
+    }
+    armed.fd = -1;
+    armed.generation++;
+    return;
+  }
+}
+
+// A multishot read ends on error or when the buffer ring ran dry (ENOBUFS).
+// Buffers are handed back as soon as their events are decoded, and reads
+// that ended for lack of buffers are re-posted once the batch is done.
+void UringReader::harvest(const Handler &handler) {
+  uint64_t count;
+  if (read(impl->eventFd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+    return;
+  }
+
+  struct io_uring_cqe *cqe;
+  unsigned head;
+  unsigned seen = 0;
+  int returned = 0;
+  io_uring_for_each_cqe(&impl->ring, head, cqe) {
+    seen++;
+    int64_t slot = impl->lookup(io_uring_cqe_get_data64(cqe));
+    bool keep = slot >= 0;
+    if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+      unsigned short id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      if (keep) {
+        keep = handler(impl->slots[slot].fd,
+                       &impl->buffers[id * URING_BUFFER_EVENTS],
+                       cqe->res / sizeof(input_event), 0);
+      }
+      impl->provide(id, returned++);
+    } else if (keep && cqe->res < 0 && cqe->res != -ENOBUFS) {
+      keep = handler(impl->slots[slot].fd, nullptr, 0, -cqe->res);
+    }
+    if (keep && !(cqe->flags & IORING_CQE_F_MORE)) {
+      impl->rearm.push_back(static_cast<uint32_t>(slot));
+    }
+  }
+  io_uring_buf_ring_advance(impl->bufferRing, returned);
+  io_uring_cq_advance(&impl->ring, seen);
+
+  for (uint32_t slot : impl->rearm) {
+    if (impl->slots[slot].fd != -1) {
+      impl->post(slot);
+    }
+  }
+  impl->rearm.clear();
+}
+
+#else
+
+using namespace std;
+
+struct UringReader::Impl {};
+
+unique_ptr<UringReader> UringReader::create() { return nullptr; }
+
+UringReader::UringReader(unique_ptr<Impl> impl) : impl(move(impl)) {}
+
+UringReader::~UringReader() {}
+
+int UringReader::notifyFd() const { return -1; }
+
+bool UringReader::arm(int) { return false; }
+
+void UringReader::disarm(int) {}
+
+void UringReader::harvest(const Handler &) {}
+
+#endif
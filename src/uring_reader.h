@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <linux/input.h>
+#include <memory>
+
+// Keeps a multishot read posted on every device fd, with the kernel picking
+// buffers from a shared provided-buffer ring. One eventfd wakeup then
+// harvests the input of every device that produced events, without a
+// readiness notification plus read() per device. create() returns nullptr
+// when waypad was built without liburing or the running kernel lacks
+// multishot reads, and the caller falls back to epoll.
+// Each read is tagged with a slot and that slot's generation rather than
+// the fd, and disarm() cancels it before the caller closes the fd, so a
+// completion still in flight for a closed device is dropped instead of
+// being credited to whatever reuses its fd number.
+class UringReader {
+public:
+  // Called once per completion with either a batch of events or an errno.
+  // Returning false stops reading from that fd.
+  using Handler = std::function<bool(int fd, const input_event *events,
+                                     size_t count, int error)>;
+
+  static std::unique_ptr<UringReader> create();
+  ~UringReader();
+  int notifyFd() const;
+  bool arm(int fd);
+  // Must be called while fd is still open.
+  void disarm(int fd);
+  void harvest(const Handler &handler);
+
+private:
+  struct Impl;
+  explicit UringReader(std::unique_ptr<Impl> impl);
+  std::unique_ptr<Impl> impl;
+};
@@ -0,0 +1,99 @@
+#include "virtual_gamepad.h"
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <linux/uinput.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+VirtualGamepad::VirtualGamepad(const string &name, uint16_t vendor,
+                               uint16_t product,
+                               const input_absinfo (&absinfo)[AXIS_COUNT]) {
+  fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    throw runtime_error("Failed to open /dev/uinput: " +
+                        string(strerror(errno)));
+  }
+
+  bool ok = ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_ABS) == 0 &&
+            ioctl(fd, UI_SET_EVBIT, EV_SYN) == 0;
+  for (unsigned int code = BTN_A; ok && code <= BTN_THUMBR; code++) {
+    ok = ioctl(fd, UI_SET_KEYBIT, code) == 0;
+  }
+  for (unsigned int code = ABS_X; ok && code <= ABS_RZ; code++) {
+    if (absinfo[code].maximum == absinfo[code].minimum) {
+      continue;
+    }
+    struct uinput_abs_setup abs = {};
+    abs.code = code;
+    abs.absinfo = absinfo[code];
+    ok = ioctl(fd, UI_SET_ABSBIT, code) == 0 &&
+         ioctl(fd, UI_ABS_SETUP, &abs) == 0;
+  }
+
+  struct uinput_setup setup = {};
+  setup.id.bustype = BUS_VIRTUAL;
+  setup.id.vendor = vendor;
+  setup.id.product = product;
+  strncpy(setup.name, name.c_str(), UINPUT_MAX_NAME_SIZE - 1);
+  ok = ok && ioctl(fd, UI_DEV_SETUP, &setup) == 0 &&
+       ioctl(fd, UI_DEV_CREATE) == 0;
+
+  if (!ok) {
+    int error = errno;
+    close(fd);
+    throw runtime_error("Failed to create uinput device: " +
+                        string(strerror(error)));
+  }
+  path = uinputNode(fd);
+  if (path.empty()) {
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+    throw runtime_error("uinput device has no event node");
+  }
+}
+
+string uinputNode(int fd) {
+  char sysname[64] = {};
+  if (ioctl(fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+    return "";
+  }
+  filesystem::path sysfs = filesystem::path("/sys/devices/virtual/input") /
+                           sysname;
+  error_code ec;
+  for (const auto &entry : filesystem::directory_iterator(sysfs, ec)) {
+    string node = entry.path().filename().string();
+    if (node.compare(0, 5, "event") == 0) {
+      return "/dev/input/" + node;
+    }
+  }
+  return "";
+}
+
+bool waitForNode(const string &path) {
+  error_code ec;
+  for (int attempt = 0; attempt < 100 && !filesystem::exists(path, ec);
+       attempt++) {
+    this_thread::sleep_for(chrono::milliseconds(10));
+  }
+  return filesystem::exists(path, ec);
+}
+
+VirtualGamepad::~VirtualGamepad() {
+  if (fd != -1) {
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+  }
+}
+
+bool VirtualGamepad::emit(const input_event *events, size_t count) {
+  size_t length = count * sizeof(input_event);
+  return write(fd, events, length) == static_cast<ssize_t>(length);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include "gamepad.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// The /dev/input/eventN node of a uinput device, or an empty string if it
+// cannot be found. The kernel lists it in sysfs by the time UI_DEV_CREATE
+// returns, so this never waits, but devtmpfs may only create the node a
+// moment later.
+std::string uinputNode(int fd);
+
+// Waits up to a second for a node from uinputNode() to appear, for tools
+// that open a device they have just created. Never called by the daemon.
+bool waitForNode(const std::string &path);
+
+// A uinput device advertising the buttons and axes Gamepad decodes, used
+// to feed real kernel event nodes from benchmarks and load generators.
+// Creating one needs write access to /dev/uinput, and devicePath() may
+// need waitForNode() before it can be opened.
+class VirtualGamepad {
+public:
+  VirtualGamepad(const std::string &name, uint16_t vendor, uint16_t product,
+                 const input_absinfo (&absinfo)[AXIS_COUNT]);
+  VirtualGamepad(const VirtualGamepad &) = delete;
+  VirtualGamepad &operator=(const VirtualGamepad &) = delete;
+  ~VirtualGamepad();
+  bool emit(const input_event *events, size_t count);
+  const std::string &devicePath() const { return path; }
+
+private:
+  int fd = -1;
+  std::string path;
+};
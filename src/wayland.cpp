@@ -0,0 +1,154 @@
+#include "wayland.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+                                   uint32_t name, const char *interface,
+                                   uint32_t version) {
+  wlContext *context = static_cast<wlContext *>(data);
+  if (strcmp(interface, wl_compositor_interface.name) == 0) {
+    context->compositor = static_cast<wl_compositor *>(
+        wl_registry_bind(registry, name, &wl_compositor_interface, version));
+  } else if (strcmp(interface, zwp_idle_inhibit_manager_v1_interface.name) ==
+             0) {
+    context->idle_inhibit_manager =
+        static_cast<zwp_idle_inhibit_manager_v1 *>(wl_registry_bind(
+            registry, name, &zwp_idle_inhibit_manager_v1_interface, version));
+  } else if (strcmp(interface, wl_seat_interface.name) == 0 &&
+             !context->seat) {
+    // Only the object is needed, none of its events.
+    context->seat = static_cast<wl_seat *>(
+        wl_registry_bind(registry, name, &wl_seat_interface, 1));
+  } else if (strcmp(interface, ext_idle_notifier_v1_interface.name) == 0) {
+    context->idle_notifier = static_cast<ext_idle_notifier_v1 *>(
+        wl_registry_bind(registry, name, &ext_idle_notifier_v1_interface,
+                         min<uint32_t>(version, 2)));
+  }
+}
+
+static const struct wl_registry_listener registryListener = {
+    .global = registry_handle_global,
+    .global_remove = [](void *, struct wl_registry *, uint32_t) {}};
+;
+
+bool connectToWayland(wlContext &context, int fd) {
+
+  context.display = fd == -1 ? wl_display_connect(context.name)
+                             : wl_display_connect_to_fd(fd);
+  if (!context.display) {
+    cerr << "Failed to connect to wayland display "
+         << (context.name ? context.name : "") << endl;
+    return false;
+  }
+
+  struct wl_registry *registry = wl_display_get_registry(context.display);
+  if (!registry) {
+    cerr << "Failed to get wayland registry" << endl;
+    wl_display_disconnect(context.display);
+    context.display = nullptr;
+    return false;
+  }
+
+  wl_registry_add_listener(registry, &registryListener, &context);
+  wl_display_roundtrip(context.display);
+
+  if (!context.compositor || !context.idle_inhibit_manager) {
+    cerr << "Required Wayland globals not available" << endl;
+    wl_display_disconnect(context.display);
+    context.display = nullptr;
+    return false;
+  }
+
+  context.surface = wl_compositor_create_surface(context.compositor);
+  if (!context.surface) {
+    cerr << "Failed to create Wayland surface" << endl;
+    wl_display_disconnect(context.display);
+    context.display = nullptr;
+    return false;
+  }
+  wl_surface_commit(context.surface);
+
+  return true;
+}
+
+static const struct ext_idle_notification_v1_listener idleListener = {
+    .idled =
+        [](void *data, struct ext_idle_notification_v1 *) {
+          wlContext *context = static_cast<wlContext *>(data);
+          context->seat_idle = true;
+          context->seat_idle_changed = true;
+        },
+    .resumed =
+        [](void *data, struct ext_idle_notification_v1 *) {
+          wlContext *context = static_cast<wlContext *>(data);
+          context->seat_idle = false;
+          context->seat_idle_changed = true;
+        },
+};
+
+// Version 2 notifications only count user input. Version 1 ones also
+// respect idle inhibitors, so the compositor reports the seat as resumed
+// as soon as waypad's own inhibitor exists; the Inhibitor copes with that.
+bool watchSeatIdle(wlContext &context, chrono::milliseconds timeout) {
+  if (!context.idle_notifier || !context.seat) {
+    return false;
+  }
+  uint32_t ms = static_cast<uint32_t>(timeout.count());
+  context.idle_notification =
+      ext_idle_notifier_v1_get_version(context.idle_notifier) >=
+              EXT_IDLE_NOTIFIER_V1_GET_INPUT_IDLE_NOTIFICATION_SINCE_VERSION
+          ? ext_idle_notifier_v1_get_input_idle_notification(
+                context.idle_notifier, ms, context.seat)
+          : ext_idle_notifier_v1_get_idle_notification(context.idle_notifier,
+                                                       ms, context.seat);
+  ext_idle_notification_v1_add_listener(context.idle_notification,
+                                        &idleListener, &context);
+  return true;
+}
+
+bool prepareWaylandRead(wlContext &context) {
+  while (wl_display_prepare_read(context.display) != 0) {
+    if (wl_display_dispatch_pending(context.display) == -1) {
+      cerr << "Failed to dispatch Wayland events" << endl;
+      return false;
+    }
+  }
+  wl_display_flush(context.display);
+  return true;
+}
+
+bool dispatchWayland(wlContext &context, bool readable) {
+  if (readable) {
+    if (wl_display_read_events(context.display) == -1) {
+      cerr << "Failed to read Wayland events" << endl;
+      return false;
+    }
+  } else {
+    wl_display_cancel_read(context.display);
+  }
+  if (wl_display_dispatch_pending(context.display) == -1) {
+    cerr << "Failed to dispatch Wayland events" << endl;
+    return false;
+  }
+  return true;
+}
+
+void clean(wlContext &context) {
+  if (context.idle_notification) {
+    ext_idle_notification_v1_destroy(context.idle_notification);
+    context.idle_notification = nullptr;
+  }
+  if (context.idle_inhibitor) {
+    zwp_idle_inhibitor_v1_destroy(context.idle_inhibitor);
+    context.idle_inhibitor = nullptr;
+  }
+  wl_surface_destroy(context.surface);
+  wl_display_disconnect(context.display);
+  // Ready for connectToWayland() again.
+  const char *name = context.name;
+  context = wlContext();
+  context.name = name;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "ext-idle-notify-v1-client-protocol.h"
+#include "idle-inhibit-unstable-v1-client-protocol.h"
+#include <chrono>
+#include <wayland-client-core.h>
+#include <wayland-client-protocol.h>
+
+struct wlContext {
+  // Socket name or absolute path to connect to, or null for
+  // $WAYLAND_DISPLAY.
+  const char *name = nullptr;
+  struct wl_display *display = nullptr;
+  struct wl_compositor *compositor = nullptr;
+  struct wl_surface *surface = nullptr;
+  struct zwp_idle_inhibit_manager_v1 *idle_inhibit_manager = nullptr;
+  struct zwp_idle_inhibitor_v1 *idle_inhibitor = nullptr;
+  // Optional, only used by watchSeatIdle().
+  struct wl_seat *seat = nullptr;
+  struct ext_idle_notifier_v1 *idle_notifier = nullptr;
+  struct ext_idle_notification_v1 *idle_notification = nullptr;
+  bool seat_idle = false;
+  bool seat_idle_changed = false;
+};
+
+// Connects to context.name, or over an already connected socket when fd is
+// given.
+bool connectToWayland(wlContext &context, int fd = -1);
+// Asks the compositor to report when the seat has had no user input for
+// timeout; seat_idle follows the reports and seat_idle_changed is set on
+// each one. Returns false if the compositor lacks ext_idle_notifier_v1.
+bool watchSeatIdle(wlContext &context, std::chrono::milliseconds timeout);
+// One turn of the read cycle for whoever owns the connection: prepare
+// before sleeping on the display fd, then read (or cancel) and dispatch
+// after waking up. Both return false once the connection is broken.
+bool prepareWaylandRead(wlContext &context);
+bool dispatchWayland(wlContext &context, bool readable);
+// Disconnects and resets everything but the name.
+void clean(wlContext &context);